@@ -12,7 +12,7 @@
 DrumMachineAudioProcessorEditor::DrumMachineAudioProcessorEditor (DrumMachineAudioProcessor& p)
     : AudioProcessorEditor (&p), audioProcessor (p), multiGrid(p)
 {
-    setSize (940, 560);
+    setSize (940, 588);
 
     auto& apvts = audioProcessor.getAPVTS();
 
@@ -21,22 +21,62 @@ DrumMachineAudioProcessorEditor::DrumMachineAudioProcessorEditor (DrumMachineAud
 
     stepsCombo.addItem("16", 1);
     stepsCombo.addItem("32", 2);
-    stepsCombo.setSelectedId(1);
+    stepsCombo.addItem("64", 3);
+    stepsCombo.addItem("128", 4);
+    showLaneLength();
     addAndMakeVisible(stepsCombo);
-    stepsModeAttach = std::make_unique<ComboBoxAttachment>(apvts, DMParams::stepsModeId, stepsCombo);
+    // Only a choice made here sets every lane's length; the combo is updated silently
     stepsCombo.onChange = [this]() {
-        bool is32 = stepsCombo.getSelectedId() == 2;
-        audioProcessor.setGlobalStepsMode(is32);
+        audioProcessor.setGlobalNumSteps(DMParams::stepsForModeChoice(stepsCombo.getSelectedId() - 1));
         // multi grid reads from sequencers directly
         repaint();
     };
 
+    // Pattern bank slot shown in the grid; the steps combo follows its length
+    for (int i = 0; i < StepSequencer::numPatterns; ++i)
+        patternCombo.addItem("Pattern " + juce::String(i + 1), i + 1);
+    patternCombo.setSelectedId(audioProcessor.getSelectedPattern() + 1, juce::dontSendNotification);
+    addAndMakeVisible(patternCombo);
+    patternCombo.onChange = [this]() {
+        audioProcessor.selectPattern(patternCombo.getSelectedId() - 1);
+        showLaneLength();
+        multiGrid.repaint();
+    };
+
+    addAndMakeVisible(songModeButton);
+    songModeAttach = std::make_unique<ButtonAttachment>(apvts, DMParams::songModeId, songModeButton);
+
+    // Song chain as text, e.g. "1x4 2 3x2": pattern numbers with optional repeats
+    chainEditor.setText(SongTimeline::chainToString(audioProcessor.getSongChain()), false);
+    chainEditor.setTextToShowWhenEmpty("Chain, e.g. 1x4 2 3x2", juce::Colours::grey);
+    addAndMakeVisible(chainEditor);
+    auto applyChain = [this]() {
+        audioProcessor.setSongChain(SongTimeline::parseChain(chainEditor.getText()));
+        chainEditor.setText(SongTimeline::chainToString(audioProcessor.getSongChain()), false);
+    };
+    chainEditor.onReturnKey = applyChain;
+    chainEditor.onFocusLost = applyChain;
+
     swingSlider.setSliderStyle(juce::Slider::LinearHorizontal);
     swingSlider.setTextBoxStyle(juce::Slider::TextBoxRight, false, 60, 20);
     swingSlider.setLookAndFeel(&knobLNF);
     addAndMakeVisible(swingSlider);
     swingAttach = std::make_unique<SliderAttachment>(apvts, DMParams::swingId, swingSlider);
 
+    // Groove: a built-in or the groove extracted from a MIDI or audio loop, and how much of it applies
+    grooveCombo.addItemList(DMParams::grooveChoices(), 1);
+    addAndMakeVisible(grooveCombo);
+    grooveAttach = std::make_unique<ComboBoxAttachment>(apvts, DMParams::grooveId, grooveCombo);
+
+    grooveStrengthSlider.setSliderStyle(juce::Slider::LinearHorizontal);
+    grooveStrengthSlider.setTextBoxStyle(juce::Slider::TextBoxRight, false, 44, 20);
+    grooveStrengthSlider.setLookAndFeel(&knobLNF);
+    addAndMakeVisible(grooveStrengthSlider);
+    grooveStrengthAttach = std::make_unique<SliderAttachment>(apvts, DMParams::grooveStrengthId, grooveStrengthSlider);
+
+    addAndMakeVisible(extractGrooveButton);
+    extractGrooveButton.onClick = [this]() { chooseGrooveFile(); };
+
     tempoSlider.setSliderStyle(juce::Slider::RotaryHorizontalVerticalDrag);
     tempoSlider.setTextBoxStyle(juce::Slider::NoTextBox, false, 0, 0);
     tempoSlider.setName("Tempo");
@@ -137,6 +177,46 @@ DrumMachineAudioProcessorEditor::~DrumMachineAudioProcessorEditor()
 {
 }
 
+// Shows the BD lane's length in the steps combo, or nothing when it is not one of the
+// choices, without applying it to the other lanes
+void DrumMachineAudioProcessorEditor::showLaneLength()
+{
+    const int steps = audioProcessor.getBDSequencer().getNumSteps();
+    int id = 0;
+    for (int choice = 0; choice < 4; ++choice)
+        if (DMParams::stepsForModeChoice(choice) == steps)
+            id = choice + 1;
+    stepsCombo.setSelectedId(id, juce::dontSendNotification);
+}
+
+void DrumMachineAudioProcessorEditor::chooseGrooveFile()
+{
+    auto chooser = std::make_shared<juce::FileChooser>("Choose a MIDI file or an audio loop to take the groove from",
+                                                       juce::File::getSpecialLocation(juce::File::userDocumentsDirectory),
+                                                       "*.mid;*.midi;*.wav;*.aiff;*.aif");
+    chooser->launchAsync(juce::FileBrowserComponent::openMode | juce::FileBrowserComponent::canSelectFiles,
+        [this, chooser](const juce::FileChooser& fc)
+        {
+            const auto file = fc.getResult();
+            if (! file.existsAsFile())
+                return;
+
+            // Extraction runs on the processor's loader thread; the editor may be gone by the time it finishes
+            audioProcessor.extractGrooveAsync(file,
+                [safeThis = juce::Component::SafePointer<DrumMachineAudioProcessorEditor>(this), file](bool ok)
+                {
+                    if (safeThis == nullptr)
+                        return;
+                    if (ok)
+                        safeThis->grooveCombo.setSelectedItemIndex(GrooveTemplate::NumBuiltIns);
+                    else
+                        juce::NativeMessageBox::showMessageBoxAsync(juce::AlertWindow::WarningIcon,
+                                                                    "Groove extraction failed",
+                                                                    "No hits found in " + file.getFileName());
+                });
+        });
+}
+
 void DrumMachineAudioProcessorEditor::paint (juce::Graphics& g)
 {
     g.fillAll (juce::Colour::fromRGB(28, 34, 40));
@@ -162,6 +242,14 @@ void DrumMachineAudioProcessorEditor::resized()
 
     tempoSlider.setBounds(top.removeFromRight(120));
 
+    auto songRow = area.removeFromTop(28);
+    patternCombo.setBounds(songRow.removeFromLeft(110).reduced(2));
+    songModeButton.setBounds(songRow.removeFromLeft(80));
+    chainEditor.setBounds(songRow.removeFromLeft(300).reduced(2));
+    grooveCombo.setBounds(songRow.removeFromLeft(110).reduced(2));
+    grooveStrengthSlider.setBounds(songRow.removeFromLeft(160));
+    extractGrooveButton.setBounds(songRow.removeFromLeft(80).reduced(2));
+
     auto gridArea = area.removeFromTop(area.getHeight() - 240);
     multiGrid.setBounds(gridArea.reduced(6));
 
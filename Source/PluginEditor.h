@@ -27,7 +27,13 @@ private:
 
     juce::ToggleButton seqEnableButton { "Sequencer" };
     juce::ComboBox stepsCombo;
+    juce::ComboBox patternCombo;
+    juce::ToggleButton songModeButton { "Song" };
+    juce::TextEditor chainEditor;
     juce::Slider swingSlider;
+    juce::ComboBox grooveCombo;
+    juce::Slider grooveStrengthSlider;
+    juce::TextButton extractGrooveButton { "Extract..." };
     juce::Slider tempoSlider;
     juce::TextButton startButton { "Start" };
     juce::TextButton pauseButton { "Pause" };
@@ -52,8 +58,10 @@ private:
     using ButtonAttachment  = juce::AudioProcessorValueTreeState::ButtonAttachment;
 
     std::unique_ptr<ButtonAttachment>   seqEnableAttach;
-    std::unique_ptr<ComboBoxAttachment> stepsModeAttach;
+    std::unique_ptr<ButtonAttachment>   songModeAttach;
     std::unique_ptr<SliderAttachment>   swingAttach;
+    std::unique_ptr<ComboBoxAttachment> grooveAttach;
+    std::unique_ptr<SliderAttachment>   grooveStrengthAttach;
     std::unique_ptr<SliderAttachment>   tempoAttach;
     std::unique_ptr<SliderAttachment>   bdPitchAttach, bdDecayAttach, bdToneAttach, bdDriveAttach;
     std::unique_ptr<SliderAttachment>   sdPitchAttach, sdDecayAttach, sdToneAttach, sdDriveAttach;
@@ -61,5 +69,8 @@ private:
     std::unique_ptr<SliderAttachment>   ohPitchAttach, ohDecayAttach, ohToneAttach, ohDriveAttach;
     std::unique_ptr<SliderAttachment>   clapPitchAttach, clapDecayAttach, clapToneAttach, clapDriveAttach;
 
+    void chooseGrooveFile();
+    void showLaneLength();
+
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (DrumMachineAudioProcessorEditor)
 };
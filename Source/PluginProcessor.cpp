@@ -8,6 +8,7 @@
 
 #include "PluginProcessor.h"
 #include "PluginEditor.h"
+#include "utils/AllocationGuard.h"
 
 int DrumMachineAudioProcessor::getCurrentStepIndexForSequencer(const StepSequencer* s) const
 {
@@ -19,25 +20,248 @@ int DrumMachineAudioProcessor::getCurrentStepIndexForSequencer(const StepSequenc
     return -1;
 }
 
-void DrumMachineAudioProcessor::setGlobalStepsMode(bool is32)
+void DrumMachineAudioProcessor::setGlobalNumSteps(int numSteps)
 {
-    seqBD.setStepsMode(is32);
-    seqSD.setStepsMode(is32);
-    seqCH.setStepsMode(is32);
-    seqOH.setStepsMode(is32);
-    seqClap.setStepsMode(is32);
+    seqBD.setNumSteps(numSteps);
+    seqSD.setNumSteps(numSteps);
+    seqCH.setNumSteps(numSteps);
+    seqOH.setNumSteps(numSteps);
+    seqClap.setNumSteps(numSteps);
+}
+
+void DrumMachineAudioProcessor::selectPattern(int index)
+{
+    for (auto* seq : getSequencers())
+        seq->selectPattern(index);
+    playingPattern.store(seqBD.getSelectedPattern(), std::memory_order_relaxed);
+}
+
+void DrumMachineAudioProcessor::setSongChain(const SongChain& chain)
+{
+    songChain = chain;
+    rebuildSongTimeline();
+}
+
+void DrumMachineAudioProcessor::rebuildSongTimeline()
+{
+    const auto sequencers = getSequencers();
+    songBarTicks = lastBarTicks.load(std::memory_order_relaxed);
+    songTimelines.getWriteSlot().compile(songChain, sequencers.data(), (int) sequencers.size(), songBarTicks);
+    songTimelines.publish();
+    songTimelineStale = false;
+}
+
+void DrumMachineAudioProcessor::timerCallback()
+{
+    if (songTimelineStale || lastBarTicks.load(std::memory_order_relaxed) != songBarTicks)
+        rebuildSongTimeline();
+}
+
+void DrumMachineAudioProcessor::extractGrooveAsync(const juce::File& file, SampleLoader::Callback onExtracted)
+{
+    auto groove = std::make_shared<GrooveTemplate>();
+    const double bpm = lastBpm.load();
+    sampleLoader.runAsync([file, bpm, groove] { return GrooveTemplate::extractFromFile(file, bpm, *groove); },
+        [weakThis = juce::WeakReference<DrumMachineAudioProcessor>(this), groove, onExtracted](bool ok)
+        {
+            if (weakThis == nullptr)
+                return;
+            if (ok)
+                weakThis->setExtractedGroove(*groove);
+            if (onExtracted)
+                onExtracted(ok);
+        });
+}
+
+void DrumMachineAudioProcessor::setExtractedGroove(const GrooveTemplate& groove)
+{
+    extractedGroove = groove;
+    extractedGrooves.getWriteSlot().compile(groove, ++lastGrooveId);
+    extractedGrooves.publish();
+}
+
+StepSequencer* DrumMachineAudioProcessor::getSequencerForLane(int laneIndex)
+{
+    switch (laneIndex)
+    {
+        case 0: return &seqBD;
+        case 1: return &seqSD;
+        case 2: return &seqCH;
+        case 3: return &seqOH;
+        case 4: return &seqClap;
+        default: return nullptr;
+    }
+}
+
+SampleLayer* DrumMachineAudioProcessor::getSampleLayerForLane(int laneIndex)
+{
+    switch (laneIndex)
+    {
+        case 0: return &bdSampleLayer;
+        case 1: return &sdSampleLayer;
+        case 2: return &chSample;
+        case 3: return &ohSample;
+        case 4: return &clapSample;
+        default: return nullptr;
+    }
 }
 
 bool DrumMachineAudioProcessor::loadSampleForLane(int laneIndex, const juce::File& file)
 {
+    auto* layer = getSampleLayerForLane(laneIndex);
+    return layer != nullptr && layer->loadFromFile(file);
+}
+
+void DrumMachineAudioProcessor::loadSampleForLaneAsync(int laneIndex, const juce::File& file, SampleLoader::Callback onLoaded)
+{
+    if (auto* layer = getSampleLayerForLane(laneIndex))
+        sampleLoader.loadAsync(*layer, file, std::move(onLoaded));
+    else if (onLoaded)
+        onLoaded(false);
+}
+
+void DrumMachineAudioProcessor::setSampleStorageForLane(int laneIndex, SampleData::Storage storage)
+{
+    if (auto* layer = getSampleLayerForLane(laneIndex))
+        layer->setStorage(storage);
+}
+
+juce::uint32 DrumMachineAudioProcessor::getSampleStreamUnderruns()
+{
+    juce::uint32 total = 0;
+    for (int lane = 0; lane < numLanes; ++lane)
+        total += getSampleLayerForLane(lane)->getNumStreamUnderruns();
+    return total;
+}
+
+void DrumMachineAudioProcessor::setChokeGroup(int laneIndex, int group)
+{
+    if (juce::isPositiveAndBelow(laneIndex, numLanes))
+        chokeGroups[(size_t) laneIndex] = juce::jmax(0, group);
+}
+
+void DrumMachineAudioProcessor::updateLaneParameters(bool snapToTargets)
+{
+    static_assert((int) LaneParameters::NumParams == (int) VoiceRamps::NumRamps, "ramps follow the lane parameter order");
+    static_assert((int) LaneParameters::NumParams == (int) StepLocks::NumParams, "locks follow the lane parameter order");
+
+    // Sounding voices take the parameters that changed, other than those their step
+    // locked, and follow them through the lane's ramps; new voices pick the
+    // coefficients up on trigger
+    const double sr = getSampleRate();
+    auto update = [this, sr, snapToTargets](int lane, auto& pool, auto& coeffs)
+    {
+        auto& params = laneParams[(size_t) lane];
+        const auto changed = params.update();
+        if (changed == 0)
+            return;
+
+        LaneParameters::apply(coeffs, changed, params, sr);
+        pool.forEachActive([&coeffs, changed](auto& voice) { voice.updateCoefficients(coeffs, changed); });
+
+        auto& smoothers = laneSmoothers[(size_t) lane];
+        for (int i = 0; i < VoiceRamps::NumRamps; ++i)
+        {
+            const float target = coeffs.getRampValue((VoiceRamps::Index) i);
+            if (snapToTargets)
+                smoothers[i].setCurrentAndTarget(target);
+            else
+                smoothers[i].setTarget(target);
+        }
+    };
+    update(0, bdVoices,   bdCoeffs);
+    update(1, sdVoices,   sdCoeffs);
+    update(2, chVoices,   chCoeffs);
+    update(3, ohVoices,   ohCoeffs);
+    update(4, clapVoices, clapCoeffs);
+}
+
+void DrumMachineAudioProcessor::updateVoiceAllocation()
+{
+    const int polyphony = (int) polyphonyParam->load(std::memory_order_relaxed);
+    const int voiceSteal = (int) voiceStealParam->load(std::memory_order_relaxed);
+    if (polyphony == lastPolyphony && voiceSteal == lastVoiceSteal)
+        return;
+    lastPolyphony = polyphony;
+    lastVoiceSteal = voiceSteal;
+    const bool stealQuietest = voiceSteal > 0;
+
+    auto configure = [&](auto& pool)
+    {
+        using Pool = std::decay_t<decltype(pool)>;
+        pool.setPolyphony(polyphony);
+        pool.setStealMode(stealQuietest ? Pool::Quietest : Pool::Oldest);
+    };
+    configure(bdVoices);
+    configure(sdVoices);
+    configure(chVoices);
+    configure(ohVoices);
+    configure(clapVoices);
+
+    for (auto* layer : { &bdSampleLayer, &sdSampleLayer, &chSample, &ohSample, &clapSample })
+    {
+        layer->setPolyphony(polyphony);
+        layer->setStealMode(stealQuietest ? SampleLayer::Voices::Quietest : SampleLayer::Voices::Oldest);
+    }
+}
+
+void DrumMachineAudioProcessor::chokeLane(int laneIndex)
+{
+    switch (laneIndex)
+    {
+        case 0: bdVoices.choke();   bdSampleLayer.choke(); break;
+        case 1: sdVoices.choke();   sdSampleLayer.choke(); break;
+        case 2: chVoices.choke();   chSample.choke();      break;
+        case 3: ohVoices.choke();   ohSample.choke();      break;
+        case 4: clapVoices.choke(); clapSample.choke();    break;
+        default: break;
+    }
+}
+
+void DrumMachineAudioProcessor::triggerLane(int laneIndex, float velocity, const StepLocks& locks)
+{
+    const int group = chokeGroups[(size_t) laneIndex];
+    if (group != 0)
+        for (int other = 0; other < numLanes; ++other)
+            if (other != laneIndex && chokeGroups[(size_t) other] == group)
+                chokeLane(other);
+
+    // Unlocked hits copy the lane coefficients as they are; a lock recomputes only
+    // the parts it overrides
+    const double sr = getSampleRate();
+    auto startVoice = [velocity, &locks, sr](auto& pool, const auto& laneCoeffs)
+    {
+        auto& voice = pool.startVoice();
+        voice.setLockMask(locks.mask);
+        if (locks.mask == 0)
+        {
+            voice.setCoefficients(laneCoeffs);
+        }
+        else
+        {
+            auto coeffs = laneCoeffs;
+            locks.apply(coeffs, sr);
+            voice.setCoefficients(coeffs);
+        }
+        voice.noteOn(velocity);
+    };
+    const float pitch = locks.has(StepLocks::Pitch) ? locks.values[StepLocks::Pitch]
+                                                         : laneParams[(size_t) laneIndex].get(LaneParameters::Pitch);
+    auto startSample = [&](SampleLayer& layer, float gain)
+    {
+        layer.setParameters(pitch, 0, gain);
+        layer.noteOn(velocity);
+    };
+
     switch (laneIndex)
     {
-        case 0: return bdSampleLayer.loadFromFile(file);
-        case 1: return sdSampleLayer.loadFromFile(file);
-        case 2: return chSample.loadFromFile(file);
-        case 3: return ohSample.loadFromFile(file);
-        case 4: return clapSample.loadFromFile(file);
-        default: return false;
+        // BD and SD layer the sample under the synth voice; the other lanes replace it
+        case 0: startVoice(bdVoices, bdCoeffs); if (bdSampleLayer.isLoaded()) startSample(bdSampleLayer, 0.35f); break;
+        case 1: startVoice(sdVoices, sdCoeffs); if (sdSampleLayer.isLoaded()) startSample(sdSampleLayer, 0.35f); break;
+        case 2: if (chSample.isLoaded())   startSample(chSample, 1.0f);   else startVoice(chVoices, chCoeffs);     break;
+        case 3: if (ohSample.isLoaded())   startSample(ohSample, 1.0f);   else startVoice(ohVoices, ohCoeffs);     break;
+        case 4: if (clapSample.isLoaded()) startSample(clapSample, 1.0f); else startVoice(clapVoices, clapCoeffs); break;
+        default: break;
     }
 }
 
@@ -53,10 +277,34 @@ DrumMachineAudioProcessor::DrumMachineAudioProcessor()
                        )
 #endif
 {
+    for (int lane = 0; lane < numLanes; ++lane)
+        laneParams[(size_t) lane].attach(apvts, DMParams::laneParamIds[lane]);
+
+    seqEnableParam  = apvts.getRawParameterValue(DMParams::seqEnableId);
+    songModeParam   = apvts.getRawParameterValue(DMParams::songModeId);
+    swingParam      = apvts.getRawParameterValue(DMParams::swingId);
+    tempoParam      = apvts.getRawParameterValue(DMParams::tempoId);
+    grooveParam     = apvts.getRawParameterValue(DMParams::grooveId);
+    grooveStrengthParam = apvts.getRawParameterValue(DMParams::grooveStrengthId);
+    polyphonyParam  = apvts.getRawParameterValue(DMParams::polyphonyId);
+    voiceStealParam = apvts.getRawParameterValue(DMParams::voiceStealId);
+    for (int lane = 0; lane < numLanes; ++lane)
+        interpolationParams[(size_t) lane] = apvts.getRawParameterValue(DMParams::laneInterpolationIds[lane]);
+
+    for (auto* seq : getSequencers())
+        seq->onPatternChanged = [this] { songTimelineStale = true; };
+    rebuildSongTimeline();
+    startTimerHz(10);
+
+    jassert(DMParams::grooveChoices().size() == GrooveTemplate::NumBuiltIns + 1);
+    for (int i = 0; i < GrooveTemplate::NumBuiltIns; ++i)
+        builtInGrooves[(size_t) i].compile(GrooveTemplate::makeBuiltIn(i), i);
+    setExtractedGroove({});
 }
 
 DrumMachineAudioProcessor::~DrumMachineAudioProcessor()
 {
+    stopTimer();
 }
 
 const juce::String DrumMachineAudioProcessor::getName() const
@@ -124,18 +372,47 @@ void DrumMachineAudioProcessor::changeProgramName (int index, const juce::String
 
 void DrumMachineAudioProcessor::prepareToPlay (double sampleRate, int samplesPerBlock)
 {
-    juce::ignoreUnused(samplesPerBlock);
-    bdVoice.prepare(sampleRate);
-    sdVoice.prepare(sampleRate);
-    chVoice.prepare(sampleRate);
-    ohVoice.prepare(sampleRate);
-    clapVoice.prepare(sampleRate);
+    bdVoices.prepare(sampleRate);
+    sdVoices.prepare(sampleRate);
+    chVoices.prepare(sampleRate);
+    ohVoices.prepare(sampleRate);
+    clapVoices.prepare(sampleRate);
+
+    for (auto& queue : laneTriggers)
+        queue.reserve(StepSequencer::maxTriggersPerBlock);
+    scheduler.reserve(numLanes * StepSequencer::maxTriggersPerBlock + maxMidiEventsPerBlock);
+
+    bdSampleLayer.prepare(sampleRate, samplesPerBlock);
+    sdSampleLayer.prepare(sampleRate, samplesPerBlock);
+    chSample.prepare(sampleRate, samplesPerBlock);
+    ohSample.prepare(sampleRate, samplesPerBlock);
+    clapSample.prepare(sampleRate, samplesPerBlock);
+
+    // Bring loaded samples to the new rate. Offline renders wait for it so the output is
+    // deterministic; otherwise the loader converts them while the old copies keep playing.
+    for (auto* layer : { &bdSampleLayer, &sdSampleLayer, &chSample, &ohSample, &clapSample })
+    {
+        if (! layer->hasSample())
+            continue;
+        if (isNonRealtime())
+            layer->convertToSessionRate();
+        else
+            sampleLoader.convertAsync(*layer);
+    }
+
+    // Coefficients depend on the sample rate; start from the current values without ramping
+    for (auto& smoothers : laneSmoothers)
+        smoothers.prepare(sampleRate, samplesPerBlock);
+    for (auto& params : laneParams)
+        params.invalidate();
+    updateLaneParameters(true);
+    for (auto& ramps : laneRamps)
+        ramps = {};
+    lastPolyphony = lastVoiceSteal = -1;
 
-    bdSampleLayer.prepare(sampleRate);
-    sdSampleLayer.prepare(sampleRate);
-    chSample.prepare(sampleRate);
-    ohSample.prepare(sampleRate);
-    clapSample.prepare(sampleRate);
+    // Edits made without a message loop, as in offline renders, reach the song here
+    if (songTimelineStale)
+        rebuildSongTimeline();
 
     internalPPQ = 0.0;
     internalPlaying = true;
@@ -168,44 +445,30 @@ bool DrumMachineAudioProcessor::isBusesLayoutSupported (const BusesLayout& layou
 void DrumMachineAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages)
 {
     juce::ScopedNoDenormals noDenormals;
+   #if DM_CHECK_AUDIO_ALLOCATIONS
+    AllocationGuard::ScopedNoAllocation noAllocation;
+   #endif
 
     auto totalNumInputChannels  = getTotalNumInputChannels();
     auto totalNumOutputChannels = getTotalNumOutputChannels();
     for (auto i = totalNumInputChannels; i < totalNumOutputChannels; ++i)
         buffer.clear (i, 0, buffer.getNumSamples());
 
-    // Read parameters for all voices
-    bdVoice.setParameters(*apvts.getRawParameterValue(DMParams::bdPitchId),
-                          *apvts.getRawParameterValue(DMParams::bdDecayId),
-                          *apvts.getRawParameterValue(DMParams::bdToneId),
-                          *apvts.getRawParameterValue(DMParams::bdDriveId));
-
-    sdVoice.setParameters(*apvts.getRawParameterValue(DMParams::sdPitchId),
-                          *apvts.getRawParameterValue(DMParams::sdDecayId),
-                          *apvts.getRawParameterValue(DMParams::sdToneId),
-                          *apvts.getRawParameterValue(DMParams::sdDriveId));
-
-    chVoice.setParameters(*apvts.getRawParameterValue(DMParams::chPitchId),
-                          *apvts.getRawParameterValue(DMParams::chDecayId),
-                          *apvts.getRawParameterValue(DMParams::chToneId),
-                          *apvts.getRawParameterValue(DMParams::chDriveId));
-
-    ohVoice.setParameters(*apvts.getRawParameterValue(DMParams::ohPitchId),
-                          *apvts.getRawParameterValue(DMParams::ohDecayId),
-                          *apvts.getRawParameterValue(DMParams::ohToneId),
-                          *apvts.getRawParameterValue(DMParams::ohDriveId));
-
-    clapVoice.setParameters(*apvts.getRawParameterValue(DMParams::clapPitchId),
-                            *apvts.getRawParameterValue(DMParams::clapDecayId),
-                            *apvts.getRawParameterValue(DMParams::clapToneId),
-                            *apvts.getRawParameterValue(DMParams::clapDriveId));
+    updateLaneParameters(false);
+    updateVoiceAllocation();
+    for (int lane = 0; lane < numLanes; ++lane)
+    {
+        auto* layer = getSampleLayerForLane(lane);
+        layer->setInterpolation((Interpolation::Quality) (int) interpolationParams[(size_t) lane]->load(std::memory_order_relaxed));
+        layer->setNonRealtime(isNonRealtime());
+    }
 
-    bool seqEnable = apvts.getRawParameterValue(DMParams::seqEnableId)->load() > 0.5f;
-    int stepsChoice = (int)apvts.getRawParameterValue(DMParams::stepsModeId)->load();
-    float swingAmount = apvts.getRawParameterValue(DMParams::swingId)->load();
-    double tempo = (double) apvts.getRawParameterValue(DMParams::tempoId)->load();
+    bool seqEnable = seqEnableParam->load() > 0.5f;
+    float swingAmount = swingParam->load();
+    double tempo = (double) tempoParam->load();
+    const int numSamples = buffer.getNumSamples();
 
-    juce::Array<StepSequencer::Trigger> trBD, trSD, trCH, trOH, trClap;
+    scheduler.clear();
 
     if (seqEnable)
     {
@@ -217,6 +480,13 @@ void DrumMachineAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer,
             {
                 pos.isPlaying = positionInfo->getIsPlaying();
                 pos.bpm = positionInfo->getBpm().orFallback(120.0);
+                pos.ppqPosition = positionInfo->getPpqPosition().orFallback(0.0);
+                pos.ppqPositionOfLastBarStart = positionInfo->getPpqPositionOfLastBarStart().orFallback(0.0);
+                if (auto timeSig = positionInfo->getTimeSignature())
+                {
+                    pos.timeSigNumerator = timeSig->numerator;
+                    pos.timeSigDenominator = timeSig->denominator;
+                }
                 if (pos.isPlaying && pos.bpm > 0.0)
                     usedHost = true;
             }
@@ -231,105 +501,112 @@ void DrumMachineAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer,
             pos.ppqPositionOfLastBarStart = std::floor(internalPPQ / barPPQ) * barPPQ;
             pos.ppqPosition = internalPPQ;
         }
+        if (pos.bpm > 0.0)
+            lastBpm.store(pos.bpm, std::memory_order_relaxed);
+        lastBarTicks.store(juce::roundToInt(StepSequencer::getBarLengthPPQ(pos) * StepSequencer::ticksPerQuarter),
+                           std::memory_order_relaxed);
 
-        seqBD.computeTriggers(pos, getSampleRate(), buffer.getNumSamples(), stepsChoice == 1, swingAmount, trBD);
-        seqSD.computeTriggers(pos, getSampleRate(), buffer.getNumSamples(), stepsChoice == 1, swingAmount, trSD);
-        seqCH.computeTriggers(pos, getSampleRate(), buffer.getNumSamples(), stepsChoice == 1, swingAmount, trCH);
-        seqOH.computeTriggers(pos, getSampleRate(), buffer.getNumSamples(), stepsChoice == 1, swingAmount, trOH);
-        seqClap.computeTriggers(pos, getSampleRate(), buffer.getNumSamples(), stepsChoice == 1, swingAmount, trClap);
+        const int grooveChoice = juce::jlimit(0, (int) GrooveTemplate::NumBuiltIns, (int) grooveParam->load());
+        const auto& groove = grooveChoice < GrooveTemplate::NumBuiltIns ? builtInGrooves[(size_t) grooveChoice]
+                                                                         : extractedGrooves.read();
+        const float grooveStrength = grooveStrengthParam->load();
 
-        curBD   = seqBD.computeCurrentStepIndex(pos, stepsChoice == 1);
-        curSD   = seqSD.computeCurrentStepIndex(pos, stepsChoice == 1);
-        curCH   = seqCH.computeCurrentStepIndex(pos, stepsChoice == 1);
-        curOH   = seqOH.computeCurrentStepIndex(pos, stepsChoice == 1);
-        curClap = seqClap.computeCurrentStepIndex(pos, stepsChoice == 1);
+        if (songModeParam->load() > 0.5f)
+        {
+            const auto& song = songTimelines.read();
+            songCursor.computeTriggers(song, pos, getSampleRate(), numSamples, swingAmount, groove, grooveStrength, laneTriggers);
+            const double tick = pos.ppqPosition * SongTimeline::ticksPerQuarter;
+            auto stepAt = [&](int lane) { return pos.isPlaying ? song.getStepAt(tick, lane) : -1; };
+            curBD   = stepAt(0);
+            curSD   = stepAt(1);
+            curCH   = stepAt(2);
+            curOH   = stepAt(3);
+            curClap = stepAt(4);
+        }
+        else
+        {
+            // Read once, so every lane changes slot on the same block
+            const int pattern = playingPattern.load(std::memory_order_relaxed);
+            for (int lane = 0; lane < numLanes; ++lane)
+                getSequencerForLane(lane)->computeTriggers(pos, getSampleRate(), numSamples, pattern, swingAmount,
+                                                           groove, grooveStrength, laneTriggers[(size_t) lane]);
+
+            curBD   = seqBD.computeCurrentStepIndex(pos);
+            curSD   = seqSD.computeCurrentStepIndex(pos);
+            curCH   = seqCH.computeCurrentStepIndex(pos);
+            curOH   = seqOH.computeCurrentStepIndex(pos);
+            curClap = seqClap.computeCurrentStepIndex(pos);
+        }
 
         // advance internal PPQ if used
         if (!usedHost && internalPlaying)
         {
             const double samplesPerBeat = getSampleRate() * 60.0 / tempo;
-            internalPPQ += (double) buffer.getNumSamples() / samplesPerBeat;
+            internalPPQ += (double) numSamples / samplesPerBeat;
         }
 
-        // Trigger voices and samples
-        if (trBD.size() > 0) {
-            auto t = trBD.getReference(0);
-            bdVoice.noteOnWithDelay(t.velocity, t.sampleOffset);
-            if (bdSampleLayer.isLoaded()) {
-                bdSampleLayer.setParameters(*apvts.getRawParameterValue(DMParams::bdPitchId), 0, 0.35f); // layer mix as gain
-                bdSampleLayer.noteOnWithDelay(t.velocity, t.sampleOffset);
-            }
-        }
-        if (trSD.size() > 0) {
-            auto t = trSD.getReference(0);
-            sdVoice.noteOnWithDelay(t.velocity, t.sampleOffset);
-            if (sdSampleLayer.isLoaded()) {
-                sdSampleLayer.setParameters(*apvts.getRawParameterValue(DMParams::sdPitchId), 0, 0.35f);
-                sdSampleLayer.noteOnWithDelay(t.velocity, t.sampleOffset);
-            }
-        }
-        if (trCH.size() > 0) {
-            auto t = trCH.getReference(0);
-            if (chSample.isLoaded()) {
-                chSample.setParameters(*apvts.getRawParameterValue(DMParams::chPitchId), 0, 1.0f);
-                chSample.noteOnWithDelay(t.velocity, t.sampleOffset);
-            } else {
-                chVoice.noteOnWithDelay(t.velocity, t.sampleOffset);
-            }
-        }
-        if (trOH.size() > 0) {
-            auto t = trOH.getReference(0);
-            if (ohSample.isLoaded()) {
-                ohSample.setParameters(*apvts.getRawParameterValue(DMParams::ohPitchId), 0, 1.0f);
-                ohSample.noteOnWithDelay(t.velocity, t.sampleOffset);
-            } else {
-                ohVoice.noteOnWithDelay(t.velocity, t.sampleOffset);
-            }
-        }
-        if (trClap.size() > 0) {
-            auto t = trClap.getReference(0);
-            if (clapSample.isLoaded()) {
-                clapSample.setParameters(*apvts.getRawParameterValue(DMParams::clapPitchId), 0, 1.0f);
-                clapSample.noteOnWithDelay(t.velocity, t.sampleOffset);
-            } else {
-                clapVoice.noteOnWithDelay(t.velocity, t.sampleOffset);
-            }
-        }
+        for (int lane = 0; lane < numLanes; ++lane)
+            for (const auto& t : laneTriggers[(size_t) lane])
+                scheduler.add(t.sampleOffset, lane, t.velocity, t.locks);
     }
-    else
+
+    // MIDI mapping: C1 BD, D1 SD, F#1 CH, A#1 OH, D#1 CLAP
+    for (const auto metadata : midiMessages)
     {
-        // MIDI mapping: C1 BD, D1 SD, F#1 CH, A#1 OH, D#1 CLAP
-        for (const auto metadata : midiMessages)
+        const auto msg = metadata.getMessage();
+        if (!msg.isNoteOn())
+            continue;
+
+        const int offset = juce::jlimit(0, numSamples - 1, metadata.samplePosition);
+        const float vel = msg.getVelocity() / 127.0f;
+        switch (msg.getNoteNumber())
         {
-            const auto msg = metadata.getMessage();
-            if (msg.isNoteOn())
-            {
-                float vel = msg.getVelocity() / 127.0f;
-                switch (msg.getNoteNumber())
-                {
-                    case 36: bdVoice.noteOn(vel); if (bdSampleLayer.isLoaded()) { bdSampleLayer.setParameters(*apvts.getRawParameterValue(DMParams::bdPitchId), 0, 0.35f); bdSampleLayer.noteOnWithDelay(vel, 0); } break;
-                    case 38: sdVoice.noteOn(vel); if (sdSampleLayer.isLoaded()) { sdSampleLayer.setParameters(*apvts.getRawParameterValue(DMParams::sdPitchId), 0, 0.35f); sdSampleLayer.noteOnWithDelay(vel, 0); } break;
-                    case 42: if (chSample.isLoaded()) { chSample.setParameters(*apvts.getRawParameterValue(DMParams::chPitchId), 0, 1.0f); chSample.noteOnWithDelay(vel, 0); } else { chVoice.noteOn(vel); } break;
-                    case 46: if (ohSample.isLoaded()) { ohSample.setParameters(*apvts.getRawParameterValue(DMParams::ohPitchId), 0, 1.0f); ohSample.noteOnWithDelay(vel, 0); } else { ohVoice.noteOn(vel); } break;
-                    case 39: if (clapSample.isLoaded()) { clapSample.setParameters(*apvts.getRawParameterValue(DMParams::clapPitchId), 0, 1.0f); clapSample.noteOnWithDelay(vel, 0); } else { clapVoice.noteOn(vel); } break;
-                    default: break;
-                }
-            }
+            case 36: scheduler.add(offset, 0, vel); break;
+            case 38: scheduler.add(offset, 1, vel); break;
+            case 42: scheduler.add(offset, 2, vel); break;
+            case 46: scheduler.add(offset, 3, vel); break;
+            case 39: scheduler.add(offset, 4, vel); break;
+            default: break;
         }
     }
 
-    // Render voices and samples
-    bdVoice.render(buffer, 0, buffer.getNumSamples());
-    sdVoice.render(buffer, 0, buffer.getNumSamples());
-    chVoice.render(buffer, 0, buffer.getNumSamples());
-    ohVoice.render(buffer, 0, buffer.getNumSamples());
-    clapVoice.render(buffer, 0, buffer.getNumSamples());
+    // Ramps cover the whole block; sub-block renders index them by buffer position
+    for (int lane = 0; lane < numLanes; ++lane)
+        laneSmoothers[(size_t) lane].process(numSamples, laneRamps[(size_t) lane].data);
+    for (auto* layer : { &bdSampleLayer, &sdSampleLayer, &chSample, &ohSample, &clapSample })
+        layer->beginBlock(numSamples);
 
-    bdSampleLayer.render(buffer, 0, buffer.getNumSamples());
-    sdSampleLayer.render(buffer, 0, buffer.getNumSamples());
-    chSample.render(buffer, 0, buffer.getNumSamples());
-    ohSample.render(buffer, 0, buffer.getNumSamples());
-    clapSample.render(buffer, 0, buffer.getNumSamples());
+    // Render voices in sub-blocks between events so every hit starts on its exact sample
+    scheduler.sort();
+    int renderedUpTo = 0;
+    for (const auto& e : scheduler)
+    {
+        if (e.sampleOffset > renderedUpTo)
+        {
+            renderLanes(buffer, renderedUpTo, e.sampleOffset - renderedUpTo);
+            renderedUpTo = e.sampleOffset;
+        }
+        triggerLane(e.lane, e.velocity, e.locks);
+    }
+    renderLanes(buffer, renderedUpTo, numSamples - renderedUpTo);
+}
+
+void DrumMachineAudioProcessor::renderLanes(juce::AudioBuffer<float>& buffer, int startSample, int numSamples)
+{
+    if (numSamples <= 0)
+        return;
+
+    bdVoices.render(buffer, startSample, numSamples, laneRamps[0]);
+    sdVoices.render(buffer, startSample, numSamples, laneRamps[1]);
+    chVoices.render(buffer, startSample, numSamples, laneRamps[2]);
+    ohVoices.render(buffer, startSample, numSamples, laneRamps[3]);
+    clapVoices.render(buffer, startSample, numSamples, laneRamps[4]);
+
+    bdSampleLayer.render(buffer, startSample, numSamples);
+    sdSampleLayer.render(buffer, startSample, numSamples);
+    chSample.render(buffer, startSample, numSamples);
+    ohSample.render(buffer, startSample, numSamples);
+    clapSample.render(buffer, startSample, numSamples);
 }
 
 bool DrumMachineAudioProcessor::hasEditor() const
@@ -342,17 +619,67 @@ juce::AudioProcessorEditor* DrumMachineAudioProcessor::createEditor()
     return new DrumMachineAudioProcessorEditor (*this);
 }
 
+void DrumMachineAudioProcessor::restorePatternState(const juce::ValueTree& patterns)
+{
+    for (const auto& laneTree : patterns)
+    {
+        auto* seq = getSequencerForLane((int) laneTree.getProperty("index", -1));
+        if (seq == nullptr)
+            continue;
+
+        const auto on = laneTree.getProperty("on").toString();
+        const auto accent = laneTree.getProperty("accent").toString();
+        seq->applyEdits([&]
+        {
+            seq->setNumSteps((int) laneTree.getProperty("steps", 16));
+            for (int i = 0; i < seq->getNumSteps(); ++i)
+            {
+                seq->setStepOn(i, i < on.length() && on[i] == 'x');
+                seq->setAccent(i, i < accent.length() && accent[i] == 'x');
+            }
+        });
+    }
+}
+
 void DrumMachineAudioProcessor::getStateInformation (juce::MemoryBlock& destData)
 {
-    juce::MemoryOutputStream mos(destData, true);
-    apvts.state.writeToStream(mos);
+    // The stream keeps its capacity across calls, so repeated saves only allocate
+    // for the parameter tree copy and destData itself
+    stateStream.reset();
+    const auto sequencers = getSequencers();
+    PatternChunk::write(stateStream, sequencers.data(), (int) sequencers.size(), songChain, extractedGroove);
+    apvts.copyState().writeToStream(stateStream);
+    destData.replaceAll(stateStream.getData(), stateStream.getDataSize());
 }
 
 void DrumMachineAudioProcessor::setStateInformation (const void* data, int sizeInBytes)
 {
-    auto tree = juce::ValueTree::readFromData(data, (size_t) sizeInBytes);
-    if (tree.isValid())
-        apvts.replaceState(tree);
+    const auto sequencers = getSequencers();
+    auto chain = songChain;
+    auto groove = extractedGroove;
+    const auto patternBytes = PatternChunk::read(data, (size_t) sizeInBytes, sequencers.data(), (int) sequencers.size(), chain, groove);
+    selectPattern(seqBD.getSelectedPattern());
+    setSongChain(chain);
+    setExtractedGroove(groove);
+
+    auto tree = juce::ValueTree::readFromData(static_cast<const char*>(data) + patternBytes, (size_t) sizeInBytes - patternBytes);
+    if (! tree.isValid())
+        return;
+
+    // States saved before the pattern chunk keep their patterns in the tree
+    auto patterns = tree.getChildWithName("PATTERNS");
+    if (patterns.isValid())
+    {
+        if (patternBytes == 0)
+            restorePatternState(patterns);
+        tree.removeChild(patterns, nullptr);
+    }
+
+    // Older states saved no patterns, only the Steps Mode parameter every lane played at
+    auto stepsMode = tree.getChildWithProperty("id", DMParams::stepsModeId);
+    if (stepsMode.isValid() && patternBytes == 0 && ! patterns.isValid())
+        setGlobalNumSteps(DMParams::stepsForModeChoice((int) stepsMode.getProperty("value", 0)));
+    apvts.replaceState(tree);
 }
 
 juce::AudioProcessor* JUCE_CALLTYPE createPluginFilter()
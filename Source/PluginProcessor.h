@@ -10,14 +10,24 @@
 
 #include <JuceHeader.h>
 #include "params/ParameterLayout.h"
+#include "params/LaneParameters.h"
 #include "voices/BDVoice.h"
 #include "voices/SDVoice.h"
 #include "voices/HHVoice.h"
 #include "voices/ClapVoice.h"
+#include "voices/VoicePool.h"
+#include "dsp/ParameterSmoother.h"
 #include "sequencer/StepSequencer.h"
+#include "sequencer/PatternChunk.h"
+#include "sequencer/SongTimeline.h"
+#include "sequencer/GrooveTemplate.h"
+#include "sequencer/TriggerQueue.h"
+#include "sequencer/EventScheduler.h"
 #include "sampling/SampleLayer.h"
+#include "sampling/SampleLoader.h"
 
-class DrumMachineAudioProcessor  : public juce::AudioProcessor
+class DrumMachineAudioProcessor  : public juce::AudioProcessor,
+                                   private juce::Timer
 {
 public:
     DrumMachineAudioProcessor();
@@ -52,24 +62,116 @@ public:
     StepSequencer& getOHSequencer()   { return seqOH; }
     StepSequencer& getClapSequencer() { return seqClap; }
 
+    // Lane index: 0 BD, 1 SD, 2 CH, 3 OH, 4 Clap
+    StepSequencer* getSequencerForLane(int laneIndex);
+
     int getCurrentStepIndexForSequencer(const StepSequencer* s) const;
-    void setGlobalStepsMode(bool is32);
+
+    // Sets every lane to the same length; lanes keep their own divisions
+    void setGlobalNumSteps(int numSteps);
+
+    // Pattern banks and song mode, message thread only. Every lane edits and plays
+    // the same bank slot, and all of them change slot on the same block; the song
+    // chain plays slots in turn while Song Mode is on.
+    void selectPattern(int index);
+    int getSelectedPattern() const { return seqBD.getSelectedPattern(); }
+    void setSongChain(const SongChain& chain);
+    const SongChain& getSongChain() const { return songChain; }
+
+    // Grooves, message thread only. The Groove parameter picks a built-in or the
+    // groove extracted last. Extraction reads a MIDI file or an audio loop on the
+    // loader thread and reports back on the message thread; an audio loop is taken
+    // to be whole bars near the tempo played last.
+    void extractGrooveAsync(const juce::File& file, SampleLoader::Callback onExtracted);
+    void setExtractedGroove(const GrooveTemplate& groove);
+    const GrooveTemplate& getExtractedGroove() const { return extractedGroove; }
 
     // Internal transport controls
     void startInternalTransport() { internalPlaying = true; }
     void pauseInternalTransport() { internalPlaying = false; }
     void restartInternalTransport() { internalPPQ = 0.0; internalPlaying = true; }
 
-    // Sample loading per lane: 0 BD layer, 1 SD layer, 2 CH, 3 OH, 4 Clap
+    // Sample loading per lane: 0 BD layer, 1 SD layer, 2 CH, 3 OH, 4 Clap.
+    // file may also be a folder of velocity layers and round-robin variants (see SampleZoneMap).
+    // Both are safe while audio is running; the async version never blocks the caller
+    // and reports back on the message thread.
     bool loadSampleForLane(int laneIndex, const juce::File& file);
+    void loadSampleForLaneAsync(int laneIndex, const juce::File& file, SampleLoader::Callback onLoaded);
+
+    // Memory-mapped storage plays uncompressed WAV/AIFF straight from the file mapping
+    // instead of decoding it into RAM; streamed storage keeps only the first frames in
+    // RAM and reads the rest from disk while playing. Applies to the lane's next load.
+    void setSampleStorageForLane(int laneIndex, SampleData::Storage storage);
+
+    // Streamed frames played as silence because the disk fell behind, over all lanes
+    juce::uint32 getSampleStreamUnderruns();
+
+    // Lanes sharing a non-zero choke group cut each other off (CH and OH by default)
+    void setChokeGroup(int laneIndex, int group);
 
 private:
+    // Patterns are stored as a PatternChunk ahead of the parameter tree in the plugin
+    // state. States saved before the chunk existed hold them as a PATTERNS child of the tree.
+    void restorePatternState(const juce::ValueTree& patterns);
+
+    static constexpr int numLanes = 5;
+
+    std::array<StepSequencer*, numLanes> getSequencers() { return { &seqBD, &seqSD, &seqCH, &seqOH, &seqClap }; }
+
+    // Compiles the chain and the banks into a timeline for the audio thread, in the
+    // host's meter as last played. Pattern edits and meter changes only mark it stale
+    // and the timer recompiles it a few times a second at most, so dragging across
+    // the grid never compiles per step.
+    void rebuildSongTimeline();
+    void timerCallback() override;
+    bool songTimelineStale { false };
+    int songBarTicks { StepSequencer::ticksPerBar };
+
+    // Reused by getStateInformation, which hosts call often for autosaves
+    juce::MemoryOutputStream stateStream;
+
+    void updateLaneParameters(bool snapToTargets);
+    void updateVoiceAllocation();
+    // Starts the lane's voices with the step's locks applied on top of the lane
+    // coefficients. A locked hit keeps its locked values while it sounds; moving the
+    // lane's other parameters still reaches it.
+    void triggerLane(int laneIndex, float velocity, const StepLocks& locks);
+    void renderLanes(juce::AudioBuffer<float>& buffer, int startSample, int numSamples);
+    void chokeLane(int laneIndex);
+    SampleLayer* getSampleLayerForLane(int laneIndex);
+
     // Voices
-    BDVoice bdVoice;
-    SDVoice sdVoice;
-    HHVoice chVoice { HHVoice::Closed };
-    HHVoice ohVoice { HHVoice::Open };
-    ClapVoice clapVoice;
+    VoicePool<BDVoice> bdVoices;
+    VoicePool<SDVoice> sdVoices;
+    VoicePool<HHVoice> chVoices { HHVoice(HHVoice::Closed) };
+    VoicePool<HHVoice> ohVoices { HHVoice(HHVoice::Open) };
+    VoicePool<ClapVoice> clapVoices;
+
+    // Voice parameter handles per lane, and the coefficients derived from them.
+    // Coefficients are recomputed only when a parameter moves; new voices copy them on trigger.
+    std::array<LaneParameters, numLanes> laneParams;
+    BDVoice::Coeffs bdCoeffs;
+    SDVoice::Coeffs sdCoeffs;
+    HHVoice::Coeffs chCoeffs, ohCoeffs;
+    ClapVoice::Coeffs clapCoeffs;
+
+    // Coefficient ramps while a lane parameter moves, filled once per block
+    std::array<SmootherGroup<VoiceRamps::NumRamps>, numLanes> laneSmoothers;
+    std::array<VoiceRamps, numLanes> laneRamps;
+
+    // Global parameter handles, resolved once in the constructor
+    std::atomic<float>* seqEnableParam { nullptr };
+    std::atomic<float>* songModeParam { nullptr };
+    std::atomic<float>* swingParam { nullptr };
+    std::atomic<float>* tempoParam { nullptr };
+    std::atomic<float>* grooveParam { nullptr };
+    std::atomic<float>* grooveStrengthParam { nullptr };
+    std::atomic<float>* polyphonyParam { nullptr };
+    std::atomic<float>* voiceStealParam { nullptr };
+    std::array<std::atomic<float>*, numLanes> interpolationParams {};
+    int lastPolyphony { -1 };
+    int lastVoiceSteal { -1 };
+    std::array<int, numLanes> chokeGroups { 0, 0, 1, 1, 0 };
 
     // Sample layers
     SampleLayer bdSampleLayer;
@@ -78,9 +180,37 @@ private:
     SampleLayer ohSample;
     SampleLayer clapSample;
 
+    // Loads files off the audio and message threads; declared after the layers it feeds
+    SampleLoader sampleLoader;
+
     // Sequencers per lane
     StepSequencer seqBD, seqSD, seqCH, seqOH, seqClap;
 
+    // The bank slot pattern mode plays, read once per block for every lane
+    std::atomic<int> playingPattern { 0 };
+
+    // Song mode: the chain (message thread), its compiled timeline and the audio
+    // thread's position in it
+    SongChain songChain { { 0, 1 } };
+    SnapshotBuffer<SongTimeline> songTimelines;
+    SongCursor songCursor;
+
+    // Grooves compiled for the audio thread: the built-ins once, the extracted groove
+    // (message thread) under a new id whenever it changes
+    std::array<GrooveTable, GrooveTemplate::NumBuiltIns> builtInGrooves;
+    GrooveTemplate extractedGroove;
+    int lastGrooveId { GrooveTemplate::NumBuiltIns };
+    SnapshotBuffer<GrooveTable> extractedGrooves;
+    std::atomic<double> lastBpm { 120.0 };
+    std::atomic<int> lastBarTicks { StepSequencer::ticksPerBar };
+
+    // Per-lane triggers for the current block, preallocated in prepareToPlay
+    std::array<TriggerQueue, numLanes> laneTriggers;
+
+    // Sequencer and MIDI hits for the current block in time order
+    static constexpr int maxMidiEventsPerBlock = 256;
+    EventScheduler scheduler;
+
     // Internal clock
     double internalPPQ { 0.0 };
     bool internalPlaying { true };
@@ -90,5 +220,6 @@ private:
 
     juce::AudioProcessorValueTreeState apvts { *this, nullptr, "PARAMS", DMParams::createParameterLayout() };
 
+    JUCE_DECLARE_WEAK_REFERENCEABLE (DrumMachineAudioProcessor)
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (DrumMachineAudioProcessor)
 };
@@ -0,0 +1,43 @@
+#pragma once
+#include <JuceHeader.h>
+
+// Saturation shared by the synth voices: x -> jmap(drive, x, tanh(x * (1 + gain * drive))),
+// applied to whole blocks. tanh is the [7/6] Lambert continued-fraction approximant with the
+// input clamped to +-4.97, max absolute error 1e-4. It has no branches or libm calls, so the
+// loops vectorise. Callers test isEngaged() once per block and skip the stage entirely when
+// the drive is off.
+namespace DriveStage
+{
+    static constexpr float threshold = 0.001f;
+
+    inline bool isEngaged(float drive) noexcept { return drive > threshold; }
+
+    inline float tanh(float x) noexcept
+    {
+        x = juce::jlimit(-4.97f, 4.97f, x);
+        const float x2 = x * x;
+        const float num = x * (135135.0f + x2 * (17325.0f + x2 * (378.0f + x2)));
+        const float den = 135135.0f + x2 * (62370.0f + x2 * (3150.0f + x2 * 28.0f));
+        return juce::jlimit(-1.0f, 1.0f, num / den);
+    }
+
+    inline float processSample(float x, float drive, float gain) noexcept
+    {
+        return x + drive * (tanh(x * (1.0f + gain * drive)) - x);
+    }
+
+    // Constant drive for the block
+    inline void process(float* samples, int numSamples, float drive, float gain) noexcept
+    {
+        const float inputGain = 1.0f + gain * drive;
+        for (int i = 0; i < numSamples; ++i)
+            samples[i] += drive * (tanh(samples[i] * inputGain) - samples[i]);
+    }
+
+    // Per-sample drive, e.g. a smoothing ramp
+    inline void process(float* samples, int numSamples, const float* drive, float gain) noexcept
+    {
+        for (int i = 0; i < numSamples; ++i)
+            samples[i] = processSample(samples[i], drive[i], gain);
+    }
+}
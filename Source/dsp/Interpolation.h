@@ -0,0 +1,122 @@
+#pragma once
+#include <JuceHeader.h>
+
+// Fractional-position read kernels for sample playback. Each kernel reads the taps
+// around src[index] and applies them at frac in [0, 1). The block functions run
+// one kernel over arrays of precomputed indices and fractions; src must hold
+// every tap they touch, from index - tapsBefore to index + tapsAfter.
+namespace Interpolation
+{
+    enum Quality { Linear, Cubic, Sinc, NumQualities };
+
+    template <Quality Q> struct Taps;
+    template <> struct Taps<Linear> { static constexpr int before = 0, after = 1; };
+    template <> struct Taps<Cubic>  { static constexpr int before = 1, after = 2; };
+    template <> struct Taps<Sinc>   { static constexpr int before = 3, after = 4; };
+
+    // 8-tap Kaiser-windowed sinc, 256 phases plus the closing phase 1.0. Each row is
+    // normalised to unity gain so DC passes unchanged at every fractional position.
+    // The table is built when the plugin loads, never on the audio thread.
+    namespace detail
+    {
+        static constexpr int sincTaps = 8;
+        static constexpr int sincPhases = 256;
+
+        struct SincTable
+        {
+            SincTable()
+            {
+                const double beta = 7.0;
+                auto i0 = [](double x)
+                {
+                    double sum = 1.0, term = 1.0;
+                    for (int k = 1; k < 40; ++k)
+                    {
+                        const double t = x / (2.0 * k);
+                        term *= t * t;
+                        sum += term;
+                    }
+                    return sum;
+                };
+
+                for (int p = 0; p <= sincPhases; ++p)
+                {
+                    const double frac = (double) p / sincPhases;
+                    double sum = 0.0;
+                    for (int k = 0; k < sincTaps; ++k)
+                    {
+                        // Tap k sits at index - 3 + k, i.e. x frames from the read position
+                        const double x = (double) (k - 3) - frac;
+                        const double sinc = std::abs(x) < 1.0e-9 ? 1.0 : std::sin(juce::MathConstants<double>::pi * x)
+                                                                        / (juce::MathConstants<double>::pi * x);
+                        const double w = x / 4.0;
+                        const double window = std::abs(w) < 1.0 ? i0(beta * std::sqrt(1.0 - w * w)) / i0(beta) : 0.0;
+                        rows[p][k] = (float) (sinc * window);
+                        sum += rows[p][k];
+                    }
+                    for (int k = 0; k < sincTaps; ++k)
+                        rows[p][k] = (float) (rows[p][k] / sum);
+                }
+            }
+
+            alignas(32) float rows[sincPhases + 1][sincTaps];
+        };
+
+        inline const SincTable sincTable;
+    }
+
+    inline float linear(const float* s, float frac)
+    {
+        return s[0] + (s[1] - s[0]) * frac;
+    }
+
+    // Catmull-Rom cubic Hermite through s[-1] .. s[2]
+    inline float cubic(const float* s, float frac)
+    {
+        const float c1 = 0.5f * (s[1] - s[-1]);
+        const float c2 = s[-1] - 2.5f * s[0] + 2.0f * s[1] - 0.5f * s[2];
+        const float c3 = 0.5f * (s[2] - s[-1]) + 1.5f * (s[0] - s[1]);
+        return ((c3 * frac + c2) * frac + c1) * frac + s[0];
+    }
+
+    // 8 taps s[-3] .. s[4], blending the two nearest table phases
+    inline float sinc(const float* s, float frac, const detail::SincTable& table = detail::sincTable)
+    {
+        const float scaled = frac * (float) detail::sincPhases;
+        const int phase = juce::jmin((int) scaled, detail::sincPhases - 1);
+        const float t = scaled - (float) phase;
+        const float* w0 = table.rows[phase];
+        const float* w1 = table.rows[phase + 1];
+        const float* taps = s - 3;
+
+        float acc = 0.0f;
+        for (int k = 0; k < detail::sincTaps; ++k)
+            acc += taps[k] * (w0[k] + (w1[k] - w0[k]) * t);
+        return acc;
+    }
+
+    template <Quality Q>
+    inline float read(const float* s, float frac)
+    {
+        if constexpr (Q == Linear) return linear(s, frac);
+        else if constexpr (Q == Cubic) return cubic(s, frac);
+        else return sinc(s, frac);
+    }
+
+    // out[i] = kernel at src[index[i]] + frac[i], for n positions
+    template <Quality Q>
+    inline void process(const float* src, const int* index, const float* frac, float* out, int n)
+    {
+        if constexpr (Q == Sinc)
+        {
+            const auto& table = detail::sincTable;
+            for (int i = 0; i < n; ++i)
+                out[i] = sinc(src + index[i], frac[i], table);
+        }
+        else
+        {
+            for (int i = 0; i < n; ++i)
+                out[i] = read<Q>(src + index[i], frac[i]);
+        }
+    }
+}
@@ -0,0 +1,130 @@
+#pragma once
+#include <JuceHeader.h>
+
+// Linear ramp from the current value to a target over a fixed time. While it moves,
+// process() writes one value per sample into a buffer preallocated in prepare();
+// once settled it writes nothing, so a static parameter costs one test per block.
+class ParameterSmoother
+{
+public:
+    void prepare(double sampleRate, int maxBlockSize, double rampSeconds = 0.02)
+    {
+        rampLength = juce::jmax(1, juce::roundToInt(rampSeconds * sampleRate));
+        capacity = juce::jmax(1, maxBlockSize);
+        ramp.allocate((size_t) capacity, true);
+        setCurrentAndTarget(target);
+    }
+
+    void setCurrentAndTarget(float value)
+    {
+        current = target = value;
+        step = 0.0f;
+        remaining = 0;
+    }
+
+    void setTarget(float value)
+    {
+        if (value == target)
+            return;
+        target = value;
+        remaining = rampLength;
+        step = (target - current) / (float) remaining;
+    }
+
+    bool isSmoothing() const { return remaining > 0; }
+    int getMaxBlockSize() const { return capacity; }
+    float getCurrentValue() const { return current; }
+    float getTargetValue() const { return target; }
+
+    // Advances by numSamples. Returns one value per sample while ramping, or nullptr
+    // when settled. Blocks longer than prepared jump straight to the target.
+    const float* process(int numSamples)
+    {
+        if (remaining == 0)
+            return nullptr;
+        if (numSamples > capacity)
+        {
+            jassertfalse;
+            setCurrentAndTarget(target);
+            return nullptr;
+        }
+
+        const int n = juce::jmin(numSamples, remaining);
+        const float start = current;
+        auto* out = ramp.get();
+        // Computed from the index rather than accumulated, so the loop vectorises
+        for (int i = 0; i < n; ++i)
+            out[i] = start + step * (float) (i + 1);
+
+        remaining -= n;
+        current = remaining == 0 ? target : out[n - 1];
+        if (n < numSamples)
+            juce::FloatVectorOperations::fill(out + n, target, numSamples - n);
+        return out;
+    }
+
+    // Writes the settled value for a block in which another smoother of the group moves
+    const float* fill(int numSamples)
+    {
+        jassert(numSamples <= capacity);
+        juce::FloatVectorOperations::fill(ramp.get(), current, juce::jmin(numSamples, capacity));
+        return ramp.get();
+    }
+
+private:
+    juce::HeapBlock<float> ramp;
+    int capacity { 0 };
+    int rampLength { 1 };
+    int remaining { 0 };
+    float current { 0.0f }, target { 0.0f }, step { 0.0f };
+};
+
+// Smoothers advanced together, e.g. the parameters of one lane. While any of them moves
+// every ramp is written out so consumers can read all of them per sample; otherwise
+// nothing is filled and the consumers keep using their settled coefficients.
+template <int NumSmoothers>
+class SmootherGroup
+{
+public:
+    using Ramps = std::array<const float*, (size_t) NumSmoothers>;
+
+    void prepare(double sampleRate, int maxBlockSize, double rampSeconds = 0.02)
+    {
+        for (auto& s : smoothers)
+            s.prepare(sampleRate, maxBlockSize, rampSeconds);
+    }
+
+    ParameterSmoother& operator[](int index) { return smoothers[(size_t) index]; }
+
+    // Returns false and clears the ramps when nothing moves this block
+    bool process(int numSamples, Ramps& ramps)
+    {
+        bool anySmoothing = false;
+        for (auto& s : smoothers)
+            anySmoothing = anySmoothing || s.isSmoothing();
+
+        if (anySmoothing && numSamples > smoothers[0].getMaxBlockSize())
+        {
+            jassertfalse; // longer than prepared: jump to the targets
+            for (auto& s : smoothers)
+                s.setCurrentAndTarget(s.getTargetValue());
+            anySmoothing = false;
+        }
+
+        if (!anySmoothing)
+        {
+            ramps.fill(nullptr);
+            return false;
+        }
+
+        for (size_t i = 0; i < smoothers.size(); ++i)
+        {
+            auto* values = smoothers[i].process(numSamples);
+            ramps[i] = values != nullptr ? values : smoothers[i].fill(numSamples);
+        }
+        return true;
+    }
+
+private:
+    std::array<ParameterSmoother, (size_t) NumSmoothers> smoothers;
+};
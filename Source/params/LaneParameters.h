@@ -0,0 +1,57 @@
+#pragma once
+#include <JuceHeader.h>
+#include "ParameterLayout.h"
+
+// Raw parameter handles for one lane, resolved once, plus the values the audio
+// thread saw last so callers only recompute what actually moved.
+class LaneParameters
+{
+public:
+    enum Index { Pitch, Decay, Tone, Drive, NumParams };
+
+    void attach(juce::AudioProcessorValueTreeState& apvts, const DMParams::LaneParamIds& ids)
+    {
+        handles = { apvts.getRawParameterValue(ids.pitch), apvts.getRawParameterValue(ids.decay),
+                    apvts.getRawParameterValue(ids.tone),  apvts.getRawParameterValue(ids.drive) };
+        for (auto* h : handles)
+            jassert(h != nullptr);
+        invalidate();
+    }
+
+    // Loads the current values; returns a bit per Index for each parameter that changed
+    juce::uint32 update()
+    {
+        juce::uint32 changed = forceChange ? (juce::uint32) ((1 << NumParams) - 1) : 0u;
+        forceChange = false;
+        for (int i = 0; i < NumParams; ++i)
+        {
+            const float v = handles[(size_t) i]->load(std::memory_order_relaxed);
+            if (v != values[(size_t) i])
+            {
+                values[(size_t) i] = v;
+                changed |= (juce::uint32) 1 << i;
+            }
+        }
+        return changed;
+    }
+
+    // Makes the next update() report every parameter, e.g. after a sample rate change
+    void invalidate() { forceChange = true; }
+
+    float get(Index i) const { return values[(size_t) i]; }
+
+    // Applies the changed parameters to a voice Coeffs struct
+    template <typename Coeffs>
+    static void apply(Coeffs& c, juce::uint32 changed, const LaneParameters& p, double sampleRate)
+    {
+        if (changed & (1u << Pitch)) c.setPitch(p.get(Pitch), sampleRate);
+        if (changed & (1u << Decay)) c.setDecay(p.get(Decay), sampleRate);
+        if (changed & (1u << Tone))  c.setTone(p.get(Tone), sampleRate);
+        if (changed & (1u << Drive)) c.setDrive(p.get(Drive), sampleRate);
+    }
+
+private:
+    std::array<std::atomic<float>*, NumParams> handles {};
+    std::array<float, NumParams> values {};
+    bool forceChange { true };
+};
@@ -35,9 +35,43 @@ namespace DMParams
 
     // Sequencer globals
     static constexpr const char* swingId     = "swing";
-    static constexpr const char* stepsModeId = "stepsMode";
+    static constexpr const char* stepsModeId = "stepsMode";   // legacy, see the layout
     static constexpr const char* seqEnableId = "seqEnable";
+    static constexpr const char* songModeId  = "songMode";
     static constexpr const char* tempoId     = "tempo";
+    static constexpr const char* grooveId    = "groove";
+    static constexpr const char* grooveStrengthId = "grooveStrength";
+
+    // Lengths offered for setting every lane at once, 16, 32, 64 or 128 steps; each
+    // lane's length and division can then be changed on its own. Lengths are pattern
+    // data, so this is an editor action; the legacy Steps Mode parameter uses the
+    // same choices.
+    inline int stepsForModeChoice(int choice) { return 16 << juce::jlimit(0, 3, choice); }
+
+    // Groove choices: the GrooveTemplate built-ins in their order, then the groove
+    // extracted last from a MIDI or audio loop
+    inline juce::StringArray grooveChoices()
+    {
+        return { "Off", "MPC 54%", "MPC 58%", "MPC 62%", "MPC 66%", "MPC 71%", "Laid Back", "Push", "Extracted" };
+    }
+
+    // Voice allocation
+    static constexpr const char* polyphonyId = "polyphony";
+    static constexpr const char* voiceStealId = "voiceSteal";
+
+    // Sample interpolation per lane: Linear, Cubic or Sinc
+    static constexpr const char* laneInterpolationIds[] = { "bdInterp", "sdInterp", "chInterp", "ohInterp", "clapInterp" };
+
+    // Per-lane voice parameter IDs, indexed 0 BD, 1 SD, 2 CH, 3 OH, 4 Clap
+    struct LaneParamIds { const char* pitch; const char* decay; const char* tone; const char* drive; };
+    static constexpr LaneParamIds laneParamIds[] =
+    {
+        { bdPitchId,   bdDecayId,   bdToneId,   bdDriveId   },
+        { sdPitchId,   sdDecayId,   sdToneId,   sdDriveId   },
+        { chPitchId,   chDecayId,   chToneId,   chDriveId   },
+        { ohPitchId,   ohDecayId,   ohToneId,   ohDriveId   },
+        { clapPitchId, clapDecayId, clapToneId, clapDriveId },
+    };
 
     inline juce::AudioProcessorValueTreeState::ParameterLayout createParameterLayout()
     {
@@ -81,11 +115,34 @@ namespace DMParams
 
         // Sequencer globals
         addFloat(swingId, "Swing", 0.0f, 0.6f, 0.0f, 1.0f);
+        // Steps Mode stays registered so host sessions that map it keep their parameter
+        // list, but lengths are pattern data now: nothing plays it, hosts cannot automate
+        // it and the editor's steps combo is not attached to it. Only states saved before
+        // per-lane lengths read it, once on load.
         params.push_back(std::make_unique<juce::AudioParameterChoice>(
-            stepsModeId, "Steps Mode", juce::StringArray{"16", "32"}, 0));
+            stepsModeId, "Steps Mode (legacy)", juce::StringArray{"16", "32", "64", "128"}, 0,
+            juce::AudioParameterChoiceAttributes().withAutomatable(false)));
         params.push_back(std::make_unique<juce::AudioParameterBool>(
             seqEnableId, "Seq Enable", false));
+        params.push_back(std::make_unique<juce::AudioParameterBool>(
+            songModeId, "Song Mode", false));
         addFloat(tempoId, "Tempo", 60.0f, 200.0f, 125.0f, 1.0f);
+        params.push_back(std::make_unique<juce::AudioParameterChoice>(
+            grooveId, "Groove", grooveChoices(), 0));
+        addFloat(grooveStrengthId, "Groove Strength", 0.0f, 1.0f, 1.0f, 1.0f);
+
+        // Voice allocation
+        params.push_back(std::make_unique<juce::AudioParameterInt>(
+            polyphonyId, "Polyphony", 1, 8, 4));
+        params.push_back(std::make_unique<juce::AudioParameterChoice>(
+            voiceStealId, "Voice Steal", juce::StringArray{"Oldest", "Quietest"}, 0));
+
+        // Sample interpolation
+        const char* const laneNames[] = { "BD", "SD", "CH", "OH", "Clap" };
+        for (int lane = 0; lane < 5; ++lane)
+            params.push_back(std::make_unique<juce::AudioParameterChoice>(
+                laneInterpolationIds[lane], juce::String(laneNames[lane]) + " Interpolation",
+                juce::StringArray{"Linear", "Cubic", "Sinc"}, 0));
 
         return { params.begin(), params.end() };
     }
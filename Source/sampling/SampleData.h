@@ -0,0 +1,188 @@
+#pragma once
+#include <JuceHeader.h>
+#include "../dsp/SincResampler.h"
+
+// Audio for one sample file. It is never modified after construction, so the
+// audio thread can read it while another thread builds its replacement.
+// Voices hold a reference while they play, which keeps a replaced sample alive
+// until its last note has finished.
+//
+// The frames are either decoded into a float buffer, or left in a memory-mapped
+// uncompressed WAV/AIFF and converted a block at a time while playing. Mapping
+// costs no RAM of its own and the page cache is shared by every instance that
+// plays the same file.
+//
+// A streamed sample keeps only its first frames decoded; SampleStreamer reads the
+// rest from the file while a voice plays it. Memory stays bounded however long or
+// numerous the files are.
+//
+// Decoded samples also keep band-limited copies decimated by whole octaves, built
+// with the sample on the loading thread. A voice pitched far up reads the copy that
+// steps closest to one frame per output sample, which keeps it free of aliasing and
+// keeps its memory traffic down.
+class SampleData : public juce::ReferenceCountedObject
+{
+public:
+    using Ptr = juce::ReferenceCountedObjectPtr<SampleData>;
+
+    enum Storage { InMemory, MemoryMapped, Streamed };
+
+    SampleData(juce::AudioBuffer<float>&& audio, double rate, const juce::File& source)
+        : buffer(std::move(audio)), octaves(buildOctaves(buffer)), sampleRate(rate), file(source),
+          numChannels(buffer.getNumChannels()), numFrames(buffer.getNumSamples()) {}
+
+    SampleData(std::unique_ptr<juce::MemoryMappedAudioFormatReader> mappedReader, const juce::File& source)
+        : mapped(std::move(mappedReader)), sampleRate(mapped->sampleRate), file(source),
+          numChannels((int) mapped->numChannels), numFrames((int) mapped->lengthInSamples) {}
+
+    // Streamed sample: head holds frames [0, head.getNumSamples()) of totalFrames
+    SampleData(juce::AudioBuffer<float>&& head, int totalFrames, double rate, const juce::File& source)
+        : buffer(std::move(head)), sampleRate(rate), file(source), numChannels(buffer.getNumChannels()),
+          numFrames(totalFrames), streamed(buffer.getNumSamples() < totalFrames) {}
+
+    // Blocks, so never call it on the audio thread. Files that cannot be mapped,
+    // such as compressed formats, fall back to being decoded.
+    static Ptr loadFromFile(const juce::File& file, Storage storage = InMemory)
+    {
+        if (storage == MemoryMapped)
+        {
+            auto data = mapFile(file);
+            if (data != nullptr)
+                return data;
+        }
+        return decodeFile(file, storage == Streamed ? preloadFrames : std::numeric_limits<int>::max());
+    }
+
+    bool isMapped() const { return mapped != nullptr; }
+    bool isStreamed() const { return streamed; }
+
+    // Mapped and streamed samples are played as stored, at the file's rate
+    bool isReadFromFile() const { return isMapped() || isStreamed(); }
+    int getNumChannels() const { return numChannels; }
+    int getNumFrames() const { return numFrames; }
+    double getSampleRate() const { return sampleRate; }
+    const juce::File& getFile() const { return file; }
+
+    // Decoded frames; empty for a mapped sample, and only the preloaded head when streamed
+    const juce::AudioBuffer<float>& getBuffer() const { return buffer; }
+    int getNumResidentFrames() const { return buffer.getNumSamples(); }
+
+    // Level 0 is the decoded buffer and level k holds every 2^k-th frame of it, low-passed
+    // below its own Nyquist frequency. Mapped samples only have level 0.
+    int getNumMipLevels() const { return 1 + (int) octaves.size(); }
+    const juce::AudioBuffer<float>& getMipLevel(int level) const { return level == 0 ? buffer : octaves[(size_t) level - 1]; }
+    int getNumMipFrames(int level) const { return level == 0 ? numFrames : octaves[(size_t) level - 1].getNumSamples(); }
+
+    // Level for a voice stepping rate frames per output sample. Each octave down halves
+    // the step; a level is used once it brings the step within half an octave of 1, so
+    // at most the top 30% of the band aliases, or is filtered away, between levels.
+    int getMipLevelForRate(double rate) const
+    {
+        int level = 0;
+        while (level + 1 < getNumMipLevels() && rate >= std::sqrt(2.0))
+        {
+            rate *= 0.5;
+            ++level;
+        }
+        return level;
+    }
+
+    // Converts frames [startFrame, startFrame + count) of a mapped sample into dest.
+    // Reads straight from the mapping, so it neither allocates nor touches the file
+    // and is safe on the audio thread.
+    void readFrames(juce::AudioBuffer<float>& dest, int startFrame, int count) const
+    {
+        jassert(isMapped() && startFrame >= 0 && startFrame + count <= numFrames && count <= dest.getNumSamples());
+        const int channels = juce::jmin(dest.getNumChannels(), numChannels, maxMappedChannels);
+        int* chans[maxMappedChannels] {};
+        for (int ch = 0; ch < channels; ++ch)
+            chans[ch] = reinterpret_cast<int*>(dest.getWritePointer(ch));
+
+        mapped->readSamples(chans, channels, 0, startFrame, count);
+        if (!mapped->usesFloatingPointData)
+            for (int ch = 0; ch < channels; ++ch)
+                juce::FloatVectorOperations::convertFixedToFloat(dest.getWritePointer(ch), chans[ch],
+                                                                 1.0f / (float) 0x7fffffff, count);
+    }
+
+    // Mapped and streamed playback read at most this many channels
+    static constexpr int maxMappedChannels = 2;
+
+    // Frames of a streamed sample kept decoded, covering the time the disk thread takes
+    // to start a stream
+    static constexpr int preloadFrames = 8192;
+
+    // Octave copies built below a decoded sample; one covers the +12 semitone pitch range
+    static constexpr int maxOctaves = 1;
+
+private:
+    // Decodes up to maxFrames; longer files become streamed samples
+    static Ptr decodeFile(const juce::File& file, int maxFrames)
+    {
+        juce::AudioFormatManager afm;
+        afm.registerBasicFormats();
+        std::unique_ptr<juce::AudioFormatReader> reader(afm.createReaderFor(file));
+        if (!reader || reader->lengthInSamples <= 0 || reader->lengthInSamples > std::numeric_limits<int>::max())
+            return nullptr;
+
+        const int channels = juce::jmax(1, (int) reader->numChannels);
+        const int samples = (int) reader->lengthInSamples;
+        if (samples > maxFrames)
+        {
+            juce::AudioBuffer<float> head(juce::jmin(channels, maxMappedChannels), maxFrames);
+            if (!reader->read(&head, 0, maxFrames, 0, true, true))
+                return nullptr;
+            return new SampleData(std::move(head), samples, reader->sampleRate, file);
+        }
+
+        juce::AudioBuffer<float> audio(channels, samples);
+        if (!reader->read(&audio, 0, samples, 0, true, true))
+            return nullptr;
+        return new SampleData(std::move(audio), reader->sampleRate, file);
+    }
+
+    static std::vector<juce::AudioBuffer<float>> buildOctaves(const juce::AudioBuffer<float>& source)
+    {
+        std::vector<juce::AudioBuffer<float>> levels;
+        const juce::AudioBuffer<float>* previous = &source;
+        for (int k = 0; k < maxOctaves && previous->getNumSamples() > 1; ++k)
+        {
+            // Output frame n is centred on input frame 2n, so level frames line up with level 0
+            levels.push_back(SincResampler::process(*previous, 2.0, 1.0));
+            previous = &levels.back();
+        }
+        return levels;
+    }
+
+    static Ptr mapFile(const juce::File& file)
+    {
+        std::unique_ptr<juce::MemoryMappedAudioFormatReader> reader;
+        if (file.hasFileExtension("wav"))
+            reader.reset(juce::WavAudioFormat().createMemoryMappedReader(file));
+        else if (file.hasFileExtension("aif;aiff"))
+            reader.reset(juce::AiffAudioFormat().createMemoryMappedReader(file));
+
+        if (!reader || reader->numChannels == 0 || reader->lengthInSamples <= 0
+            || reader->lengthInSamples > std::numeric_limits<int>::max() || !reader->mapEntireFile())
+            return nullptr;
+
+        // Touch one sample per page now, on the loading thread, so the first hit
+        // does not take its page faults on the audio thread
+        const auto framesPerPage = juce::jmax((juce::int64) 1, (juce::int64) 4096 / juce::jmax(1, (int) reader->getBytesPerFrame()));
+        for (juce::int64 frame = 0; frame < reader->lengthInSamples; frame += framesPerPage)
+            reader->touchSample(frame);
+
+        return new SampleData(std::move(reader), file);
+    }
+
+    const juce::AudioBuffer<float> buffer;
+    const std::vector<juce::AudioBuffer<float>> octaves;
+    const std::unique_ptr<juce::MemoryMappedAudioFormatReader> mapped;
+    const double sampleRate;
+    const juce::File file;
+    const int numChannels;
+    const int numFrames;
+    const bool streamed { false };
+
+    JUCE_DECLARE_NON_COPYABLE(SampleData)
+};
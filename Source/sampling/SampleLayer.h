@@ -1,105 +1,215 @@
 #pragma once
 #include <JuceHeader.h>
+#include "SamplePool.h"
+#include "SampleZoneMap.h"
+#include "SampleStreamer.h"
+#include "SampleVoice.h"
+#include "../voices/VoicePool.h"
+#include "../dsp/ParameterSmoother.h"
 
+// A lane's samples and the voices playing it. The samples form a SampleZoneMap: one
+// file, or a folder of velocity layers and round-robin variants. They come from the
+// shared SamplePool, converted to the session rate, and are published to the audio
+// thread, which picks them up in beginBlock() with a single atomic exchange. It never
+// waits on a load, a conversion or frees sample memory.
 class SampleLayer
 {
 public:
-    void prepare(double sr)
+    using Voices = VoicePool<SampleVoice>;
+
+    SampleLayer() = default;
+
+    ~SampleLayer()
+    {
+        voices.reset();
+        if (auto* unclaimed = pending.exchange(nullptr))
+            unclaimed->decReferenceCount();
+    }
+
+    // The loaded sample keeps playing, rate-converted while voices render, until
+    // convertToSessionRate() has published a copy at the new rate
+    void prepare(double sr, int maxBlockSize = 4096)
     {
+        {
+            const juce::ScopedLock sl(loadLock);
+            sessionRate = sr;
+        }
         sampleRate = sr;
+        voices.prepare(sr);
+        gainSmoother.prepare(sr, maxBlockSize);
         reset();
     }
 
+    // How files loaded into this layer are held: decoded to floats, memory-mapped and
+    // converted while playing, or streamed from disk behind a preloaded head. Takes effect
+    // from the next load. Folders are streamed unless the layer is set to memory-map them.
+    void setStorage(SampleData::Storage newStorage) { storage = newStorage; }
+    SampleData::Storage getStorage() const { return storage; }
+
+    // Fetches the file, or every sample in a folder, from the pool and converts it to
+    // the session rate, doing the work on the calling thread if no instance has it yet,
+    // then publishes it. Not for the audio thread.
     bool loadFromFile(const juce::File& file)
     {
-        juce::AudioFormatManager afm;
-        afm.registerBasicFormats();
-        std::unique_ptr<juce::AudioFormatReader> reader(afm.createReaderFor(file));
-        if (!reader) return false;
-        fileSampleRate = reader->sampleRate;
-        const int channels = (int) reader->numChannels;
-        const int samples = (int) reader->lengthInSamples;
-        buffer.setSize(std::max(1, channels), samples);
-        reader->read(&buffer, 0, samples, 0, true, true);
-        loaded = true;
-        reset();
+        const auto layerStorage = storage.load();
+        auto zones = file.isDirectory()
+                         ? SampleZoneMap::fromFolder(*pool, file, layerStorage == SampleData::InMemory ? SampleData::Streamed : layerStorage)
+                         : SampleZoneMap::fromFile(*pool, file, layerStorage);
+        if (zones == nullptr)
+            return false;
+        if (zones->hasStreamedSamples())
+            streamer->start();
+
+        const juce::ScopedLock sl(loadLock);
+        source = zones;
+        publishForSessionRate();
         return true;
     }
 
-    bool isLoaded() const { return loaded; }
+    // Publishes the loaded sample at the rate given to prepare(), resampling it on the
+    // calling thread unless the pool has that rate cached. Not for the audio thread.
+    void convertToSessionRate()
+    {
+        const juce::ScopedLock sl(loadLock);
+        if (source != nullptr)
+            publishForSessionRate();
+    }
+
+    // True once a sample has been published, even if the audio thread has not claimed it yet
+    bool hasSample() const { return hasPublished; }
 
+    // Audio thread: true when the samples in use can be played
+    bool isLoaded() const { return current != nullptr; }
+
+    // startOffsetSamples skips into the sample, in frames of the sample being played
     void setParameters(float tuneSemis, int startOffsetSamples, float gainLinear)
     {
-        tune = tuneSemis;
         startOffset = juce::jmax(0, startOffsetSamples);
-        gain = juce::jlimit(0.0f, 2.0f, gainLinear);
-        // playback rate from semitones
-        const double pitchRatio = std::pow(2.0, (double) tune / 12.0);
-        playbackRate = (fileSampleRate / sampleRate) * pitchRatio;
+        // The gain ramps while voices sound; a silent layer takes it immediately
+        const float gain = juce::jlimit(0.0f, 2.0f, gainLinear);
+        if (voices.isActive())
+            gainSmoother.setTarget(gain);
+        else
+        {
+            gainSmoother.setCurrentAndTarget(gain);
+            gainRamp = nullptr;
+        }
+        // pitch ratio from semitones, only recomputed when the tune moves
+        if (tuneSemis != tune)
+        {
+            tune = tuneSemis;
+            pitchRatio = std::pow(2.0, (double) tune / 12.0);
+        }
     }
 
-    void noteOnWithDelay(float velocity, int delaySamples)
+    // Plays the velocity layer that velocity falls in, taking its round-robin variants in turn
+    void noteOn(float velocity)
     {
-        if (!loaded) return;
-        active = true;
-        startDelaySamples = juce::jmax(0, delaySamples + startOffset);
-        position = 0.0;
-        env = juce::jlimit(0.0f, 1.0f, velocity);
+        if (current == nullptr) return;
+        const int layerIndex = current->findLayer(velocity);
+        const auto& variants = current->getLayer(layerIndex).roundRobin;
+        auto& turn = roundRobinTurns[(size_t) layerIndex];
+        const auto& data = variants[turn];
+        turn = turn + 1 < variants.size() ? turn + 1 : 0;
+
+        const double playbackRate = (data->getSampleRate() / sampleRate) * pitchRatio;
+        if (!voices.startVoice().noteOn(data, playbackRate, velocity, startOffset, *streamer))
+            ++shared.underruns;
     }
 
-    void render(juce::AudioBuffer<float>& out, int startSample, int numSamples)
+    // Claims newly published samples and advances the gain smoothing; call once per
+    // processBlock before any noteOn() or render() calls. Voices already sounding keep
+    // playing the sample they started with.
+    void beginBlock(int numSamples)
     {
-        if (!active || !loaded) return;
-        const int outChannels = out.getNumChannels();
-        const int srcChannels = buffer.getNumChannels();
-        const int srcSamples = buffer.getNumSamples();
-
-        for (int i = 0; i < numSamples; ++i)
+        if (auto* incoming = pending.exchange(nullptr))
         {
-            int idx = startSample + i;
-            if (startDelaySamples > 0) { --startDelaySamples; continue; }
-            int posInt = (int) position;
-            if (posInt >= srcSamples)
-            {
-                active = false;
-                break;
-            }
-            float frac = (float) (position - (double) posInt);
-            for (int ch = 0; ch < outChannels; ++ch)
-            {
-                const float s0 = buffer.getSample(ch < srcChannels ? ch : 0, posInt);
-                const float s1 = buffer.getSample(ch < srcChannels ? ch : 0, juce::jmin(posInt + 1, srcSamples - 1));
-                float sample = s0 + (s1 - s0) * frac; // linear interp
-                out.addSample(ch, idx, sample * env * gain);
-            }
-            position += playbackRate;
-            env *= 0.9995f; // gentle decay to avoid click if long tail
-            if (env < 1e-5f && position > srcSamples * 0.9) { active = false; break; }
+            // The pending slot's reference moves to current; the pool keeps the old map
+            // alive until the loader thread frees it
+            current = incoming;
+            incoming->decReferenceCountWithoutDeleting();
+            roundRobinTurns.fill(0);
         }
+        gainRamp = gainSmoother.process(numSamples);
+    }
+
+    // startSample is relative to the block passed to beginBlock()
+    void render(juce::AudioBuffer<float>& out, int startSample, int numSamples)
+    {
+        voices.render(out, startSample, numSamples, gainRamp, gainSmoother.getCurrentValue(), shared, quality);
     }
 
+    // Offline renders block on the disk for streamed samples rather than dropping frames
+    void setNonRealtime(bool isNonRealtime) { shared.waitForDisk = isNonRealtime; }
+
+    // Chunks of streamed notes played as silence for lack of data, plus notes that found
+    // no free stream, since the layer was created
+    juce::uint32 getNumStreamUnderruns() const { return shared.underruns.load(); }
+
+    // Kernel used to read between source frames; sounding voices switch with the next block
+    void setInterpolation(Interpolation::Quality newQuality) { quality = newQuality; }
+
+    void setPolyphony(int numVoices) { voices.setPolyphony(numVoices); }
+    void setStealMode(Voices::StealMode mode) { voices.setStealMode(mode); }
+    void choke() { voices.choke(); }
+
+    bool isActive() const { return voices.isActive(); }
+
     void reset()
     {
-        active = false;
-        startDelaySamples = 0;
-        position = 0.0;
-        env = 0.0f;
-        gain = 1.0f;
+        voices.reset();
+        gainSmoother.setCurrentAndTarget(1.0f);
+        gainRamp = nullptr;
         tune = 0.0f;
-        playbackRate = fileSampleRate / sampleRate;
+        pitchRatio = 1.0;
     }
 
 private:
-    juce::AudioBuffer<float> buffer;
+    // Declared first so they outlive every sample reference and stream below
+    juce::SharedResourcePointer<SamplePool> pool;
+    juce::SharedResourcePointer<SampleStreamer> streamer;
+
+    // Audio thread side
+    SampleZoneMap::Ptr current;
+    std::array<size_t, (size_t) SampleZoneMap::maxVelocityLayers> roundRobinTurns {};
     double sampleRate { 44100.0 };
-    double fileSampleRate { 44100.0 };
-    double playbackRate { 1.0 };
-    double position { 0.0 };
-    int startDelaySamples { 0 };
+    double pitchRatio { 1.0 };
     int startOffset { 0 };
-    float env { 0.0f };
-    float gain { 1.0f };
+    ParameterSmoother gainSmoother;
+    const float* gainRamp { nullptr };
+    SampleVoice::Shared shared;
     float tune { 0.0f };
-    bool loaded { false };
-    bool active { false };
+    Interpolation::Quality quality { Interpolation::Linear };
+    Voices voices;
+
+    // Loading side: the zones as loaded, and the version last handed to the audio thread
+    void publishForSessionRate()
+    {
+        if (published != nullptr && publishedRate == sessionRate && publishedSource == source)
+            return;
+        auto zones = source->withSampleRate(*pool, sessionRate);
+        published = zones;
+        publishedSource = source;
+        publishedRate = sessionRate;
+
+        // The pending slot owns a reference until the audio thread claims it, and the
+        // pool keeps another so the audio thread never drops the last one
+        pool->keepUntilUnused(zones.get());
+        zones->incReferenceCount();
+        if (auto* superseded = pending.exchange(zones.get()))
+            superseded->decReferenceCount();
+        hasPublished = true;
+    }
+
+    SampleZoneMap::Ptr source, publishedSource, published;
+    double publishedRate { 0.0 };
+    double sessionRate { 44100.0 };
+    juce::CriticalSection loadLock;
+
+    // Hand-over from the loading threads
+    std::atomic<SampleZoneMap*> pending { nullptr };
+    std::atomic<bool> hasPublished { false };
+    std::atomic<SampleData::Storage> storage { SampleData::InMemory };
+
+    JUCE_DECLARE_NON_COPYABLE(SampleLayer)
 };
\ No newline at end of file
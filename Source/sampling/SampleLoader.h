@@ -0,0 +1,92 @@
+#pragma once
+#include <JuceHeader.h>
+#include "SampleLayer.h"
+
+// Background thread that loads sample files and kit folders, converts them to the
+// session rate and publishes them to SampleLayers.
+// Between jobs it sweeps the shared SamplePool for samples that are no longer played,
+// so replaced sample memory is freed here rather than on the audio or message thread.
+class SampleLoader : private juce::Thread
+{
+public:
+    // Runs on the message thread once the file or folder has been loaded and published, or has failed
+    using Callback = std::function<void(bool loaded)>;
+
+    SampleLoader() : juce::Thread("DrumMachine sample loader") {}
+
+    ~SampleLoader() override
+    {
+        stopThread(4000);
+    }
+
+    // Message thread: queues the file and returns straight away. The thread starts on
+    // first use so hosts that only scan the plugin never spawn it.
+    void loadAsync(SampleLayer& layer, const juce::File& file, Callback onLoaded)
+    {
+        addJob([&layer, file] { return layer.loadFromFile(file); }, std::move(onLoaded));
+    }
+
+    // Message thread: resamples the layer's sample for the rate it was last prepared with
+    void convertAsync(SampleLayer& layer)
+    {
+        addJob([&layer] { layer.convertToSessionRate(); return true; }, {});
+    }
+
+    // Message thread: runs other file work, such as extracting a groove, in turn with
+    // the loads. task returns whether it succeeded.
+    void runAsync(std::function<bool()> task, Callback onDone)
+    {
+        addJob(std::move(task), std::move(onDone));
+    }
+
+private:
+    struct Job
+    {
+        std::function<bool()> task;
+        Callback onLoaded;
+    };
+
+    void addJob(std::function<bool()> task, Callback onLoaded)
+    {
+        {
+            const juce::ScopedLock sl(jobLock);
+            jobs.push_back({ std::move(task), std::move(onLoaded) });
+        }
+        if (!isThreadRunning())
+            startThread();
+        notify();
+    }
+
+    void run() override
+    {
+        while (!threadShouldExit())
+        {
+            std::vector<Job> batch;
+            {
+                const juce::ScopedLock sl(jobLock);
+                batch.swap(jobs);
+            }
+
+            for (auto& job : batch)
+            {
+                if (threadShouldExit())
+                    return;
+
+                const bool ok = job.task();
+                if (job.onLoaded)
+                    juce::MessageManager::callAsync([callback = std::move(job.onLoaded), ok] { callback(ok); });
+            }
+
+            // Voices release a replaced sample when their note ends, so look again shortly
+            pool->releaseUnused();
+
+            wait(500);
+        }
+    }
+
+    juce::SharedResourcePointer<SamplePool> pool;
+    std::vector<Job> jobs;
+    juce::CriticalSection jobLock;
+
+    JUCE_DECLARE_NON_COPYABLE(SampleLoader)
+};
@@ -0,0 +1,235 @@
+#pragma once
+#include <JuceHeader.h>
+#include "SampleData.h"
+#include "../dsp/SincResampler.h"
+
+// Process-wide store of loaded samples, shared by every plugin instance through
+// juce::SharedResourcePointer<SamplePool>. A file is looked up by path, size and
+// modification time first; on a miss its contents are hashed, so a copy of the same
+// file under another path also reuses the loaded data. Memory therefore scales
+// with unique samples rather than with instances times lanes.
+//
+// Each loaded sample also keeps a few copies converted to other session rates, so
+// moving a project between 44.1k and 48k does not resample it again.
+//
+// The pool holds a reference to every sample it hands out and only drops samples
+// nobody else references, from releaseUnused(). Samples are therefore never deleted
+// by the audio thread letting go of its last reference.
+class SamplePool
+{
+public:
+    // Blocks while decoding or mapping, so never call it on the audio thread
+    SampleData::Ptr load(const juce::File& file, SampleData::Storage storage)
+    {
+        const auto path = file.getFullPathName();
+        const auto size = file.getSize();
+        const auto modified = file.getLastModificationTime().toMilliseconds();
+        {
+            const juce::ScopedLock sl(lock);
+            if (auto* entry = findByPath(path, size, modified, storage))
+                return entry->data;
+        }
+
+        const auto hash = hashContents(file);
+        {
+            const juce::ScopedLock sl(lock);
+            if (auto* entry = findByContent(hash, size, storage))
+            {
+                entry->sources.push_back({ path, modified });
+                return entry->data;
+            }
+        }
+
+        auto data = SampleData::loadFromFile(file, storage);
+        if (data == nullptr)
+            return nullptr;
+
+        const juce::ScopedLock sl(lock);
+        // Another thread may have loaded the same contents meanwhile; keep the first copy
+        if (auto* entry = findByContent(hash, size, storage))
+        {
+            entry->sources.push_back({ path, modified });
+            return entry->data;
+        }
+        entries.push_back({ data, hash, size, storage, { { path, modified } } });
+        return data;
+    }
+
+    // Returns source converted to sampleRate, resampling it on the calling thread the first
+    // time each rate is asked for. source must come from load(). Mapped and streamed
+    // samples are returned as they are: converting them would decode them into RAM.
+    SampleData::Ptr getForRate(const SampleData::Ptr& source, double sampleRate)
+    {
+        if (source == nullptr || source->isReadFromFile() || source->getSampleRate() == sampleRate)
+            return source;
+
+        {
+            const juce::ScopedLock sl(lock);
+            auto* entry = findBySample(source.get());
+            if (entry == nullptr)
+            {
+                jassertfalse; // only pooled samples can be converted
+                return source;
+            }
+            if (auto converted = findConverted(*entry, sampleRate))
+                return converted;
+        }
+
+        auto converted = SampleData::Ptr(new SampleData(SincResampler::process(source->getBuffer(), source->getSampleRate(), sampleRate),
+                                                        sampleRate, source->getFile()));
+
+        const juce::ScopedLock sl(lock);
+        auto* entry = findBySample(source.get());
+        if (entry == nullptr)
+            return source;
+        if (auto existing = findConverted(*entry, sampleRate))
+            return existing;
+
+        // Most recently used rate first. Unused copies beyond the limit are dropped;
+        // a copy still in use stays until it is released.
+        auto& list = entry->converted;
+        list.insert(list.begin(), converted);
+        for (size_t i = list.size(); i-- > (size_t) maxConvertedRates;)
+            if (list[i]->getReferenceCount() == 1)
+                list.erase(list.begin() + (std::ptrdiff_t) i);
+        return converted;
+    }
+
+    // Holds an extra reference to object until releaseUnused() finds it unreferenced
+    // elsewhere, so an audio thread letting go of it never deletes it either. Used for
+    // objects that hold samples, such as a layer's zone map.
+    void keepUntilUnused(juce::ReferenceCountedObject* object)
+    {
+        const juce::ScopedLock sl(lock);
+        kept.push_back(object);
+    }
+
+    // Frees samples held only by the pool; never call on the audio thread
+    void releaseUnused()
+    {
+        std::vector<SampleData::Ptr> unused;
+        {
+            const juce::ScopedLock sl(lock);
+            // Kept objects go first: they may hold the only other reference to a sample,
+            // which the same sweep then frees. They only release samples the pool still
+            // holds, so deleting them here never frees sample memory under the lock.
+            kept.erase(std::remove_if(kept.begin(), kept.end(), [](const auto& object) { return object->getReferenceCount() == 1; }),
+                       kept.end());
+
+            for (auto it = entries.begin(); it != entries.end();)
+            {
+                if (isUnused(*it))
+                {
+                    unused.push_back(std::move(it->data));
+                    for (auto& converted : it->converted)
+                        unused.push_back(std::move(converted));
+                    it = entries.erase(it);
+                }
+                else
+                    ++it;
+            }
+        }
+        // unused goes out of scope here, outside the lock
+    }
+
+    int getNumSamples() const
+    {
+        const juce::ScopedLock sl(lock);
+        return (int) entries.size();
+    }
+
+    // Converted copies kept per sample while it stays loaded
+    static constexpr int maxConvertedRates = 3;
+
+private:
+    struct Source
+    {
+        juce::String path;
+        juce::int64 modified;
+    };
+
+    struct Entry
+    {
+        SampleData::Ptr data;
+        juce::uint64 hash;
+        juce::int64 size;
+        SampleData::Storage storage;
+        std::vector<Source> sources;
+        std::vector<SampleData::Ptr> converted;
+    };
+
+    // Nothing outside the pool references the sample or any of its converted copies
+    static bool isUnused(const Entry& entry)
+    {
+        if (entry.data->getReferenceCount() != 1)
+            return false;
+        for (const auto& converted : entry.converted)
+            if (converted->getReferenceCount() != 1)
+                return false;
+        return true;
+    }
+
+    Entry* findBySample(const SampleData* sample)
+    {
+        for (auto& entry : entries)
+            if (entry.data.get() == sample)
+                return &entry;
+        return nullptr;
+    }
+
+    static SampleData::Ptr findConverted(Entry& entry, double sampleRate)
+    {
+        auto& list = entry.converted;
+        for (size_t i = 0; i < list.size(); ++i)
+        {
+            if (list[i]->getSampleRate() == sampleRate)
+            {
+                std::rotate(list.begin(), list.begin() + (std::ptrdiff_t) i, list.begin() + (std::ptrdiff_t) i + 1);
+                return list.front();
+            }
+        }
+        return nullptr;
+    }
+
+    Entry* findByPath(const juce::String& path, juce::int64 size, juce::int64 modified, SampleData::Storage storage)
+    {
+        for (auto& entry : entries)
+            if (entry.size == size && entry.storage == storage)
+                for (const auto& source : entry.sources)
+                    if (source.modified == modified && source.path == path)
+                        return &entry;
+        return nullptr;
+    }
+
+    Entry* findByContent(juce::uint64 hash, juce::int64 size, SampleData::Storage storage)
+    {
+        for (auto& entry : entries)
+            if (entry.hash == hash && entry.size == size && entry.storage == storage)
+                return &entry;
+        return nullptr;
+    }
+
+    // 64-bit FNV-1a over the file in 64 kB blocks; 0 if the file cannot be read
+    static juce::uint64 hashContents(const juce::File& file)
+    {
+        juce::FileInputStream in(file);
+        if (!in.openedOk())
+            return 0;
+
+        juce::uint64 hash = 14695981039346656037ull;
+        juce::HeapBlock<juce::uint8> block(65536);
+        for (;;)
+        {
+            const int bytes = in.read(block.get(), 65536);
+            if (bytes <= 0)
+                break;
+            for (int i = 0; i < bytes; ++i)
+                hash = (hash ^ block[i]) * 1099511628211ull;
+        }
+        return hash;
+    }
+
+    std::vector<Entry> entries;
+    std::vector<juce::ReferenceCountedObjectPtr<juce::ReferenceCountedObject>> kept;
+    juce::CriticalSection lock;
+};
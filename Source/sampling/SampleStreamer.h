@@ -0,0 +1,186 @@
+#pragma once
+#include <JuceHeader.h>
+#include "SampleData.h"
+
+// Reads the tails of streamed samples from disk for every plugin instance, shared
+// through juce::SharedResourcePointer<SampleStreamer>. A voice playing a streamed
+// sample opens a Stream, plays the sample's resident head while the disk thread
+// starts filling the stream's ring buffer, and then reads on from the ring.
+//
+// Opening, reading and closing a stream are lock-free and never allocate, so they
+// are safe on the audio thread. The disk thread polls the open streams rather than
+// being woken, since signalling it could block the audio thread.
+class SampleStreamer : private juce::Thread
+{
+public:
+    static constexpr int numStreams = 32;
+    static constexpr int ringFrames = 32768;
+    static constexpr int readBlockFrames = 4096;
+
+    class Stream
+    {
+    public:
+        // Audio thread: copies frames [start, start + count) into dest from destStart and
+        // returns how many of them were ready. start must not go back before earlier reads.
+        int read(juce::AudioBuffer<float>& dest, int destStart, int start, int count)
+        {
+            jassert(start >= readFrame);
+            const int skip = start - readFrame;
+            int start1, size1, start2, size2;
+            fifo.prepareToRead(skip + count, start1, size1, start2, size2);
+            const int ready = juce::jmax(0, size1 + size2 - skip);
+
+            // Frame j of the readable region sits at start1 + j, wrapping round to start2
+            const int channels = juce::jmin(dest.getNumChannels(), ring.getNumChannels());
+            const int inFirst = juce::jlimit(0, ready, size1 - skip);
+            for (int ch = 0; ch < channels; ++ch)
+            {
+                if (inFirst > 0)
+                    dest.copyFrom(ch, destStart, ring, ch, start1 + skip, inFirst);
+                if (ready > inFirst)
+                    dest.copyFrom(ch, destStart + inFirst, ring, ch, start2 + juce::jmax(0, skip - size1), ready - inFirst);
+            }
+            return ready;
+        }
+
+        // Audio thread: hands ring space before frame back to the disk thread
+        void discardBefore(int frame)
+        {
+            const int n = juce::jmin(frame - readFrame, fifo.getNumReady());
+            if (n > 0)
+            {
+                fifo.finishedRead(n);
+                readFrame += n;
+            }
+        }
+
+    private:
+        friend class SampleStreamer;
+        enum State { Free, Opening, Open, Closing };
+
+        std::atomic<int> state { Free };
+        SampleData* sample { nullptr };   // referenced from open() until the disk thread frees the stream
+        int readFrame { 0 };              // audio thread: sample frame at the ring's read position
+        juce::int64 diskFrame { 0 };      // disk thread: next sample frame to read into the ring
+        juce::AbstractFifo fifo { ringFrames };
+        juce::AudioBuffer<float> ring;
+
+        // Disk thread: kept open while the stream is reused for the same file
+        std::unique_ptr<juce::AudioFormatReader> reader;
+        juce::File readerFile;
+    };
+
+    SampleStreamer() : juce::Thread("DrumMachine disk streamer") {}
+
+    ~SampleStreamer() override
+    {
+        stopThread(4000);
+        for (auto& stream : streams)
+            if (stream.state.load() != Stream::Free)
+                stream.sample->decReferenceCount();
+    }
+
+    // Allocates the ring buffers and starts the disk thread on first use. Call it from
+    // a loading thread before a streamed sample is published to the audio thread.
+    void start()
+    {
+        const juce::ScopedLock sl(startLock);
+        if (isThreadRunning())
+            return;
+        for (auto& stream : streams)
+            if (stream.ring.getNumSamples() == 0)
+                stream.ring.setSize(SampleData::maxMappedChannels, ringFrames);
+        startThread();
+    }
+
+    // Audio thread: claims a stream that reads sample from startFrame onwards, or returns
+    // null when every stream is busy or start() has not been called
+    Stream* open(SampleData& sample, int startFrame)
+    {
+        jassert(sample.isStreamed());
+        if (!isThreadRunning())
+            return nullptr;
+
+        for (auto& stream : streams)
+        {
+            int expected = Stream::Free;
+            if (stream.state.compare_exchange_strong(expected, Stream::Opening))
+            {
+                sample.incReferenceCount();
+                stream.sample = &sample;
+                stream.readFrame = startFrame;
+                stream.diskFrame = startFrame;
+                stream.fifo.reset();
+                stream.state.store(Stream::Open);
+                return &stream;
+            }
+        }
+        return nullptr;
+    }
+
+    // Audio thread: the stream must not be used after this
+    static void close(Stream& stream)
+    {
+        stream.state.store(Stream::Closing);
+    }
+
+private:
+    void run() override
+    {
+        juce::AudioFormatManager formats;
+        formats.registerBasicFormats();
+
+        while (!threadShouldExit())
+        {
+            for (auto& stream : streams)
+            {
+                const int state = stream.state.load();
+                if (state == Stream::Open)
+                    fill(stream, formats);
+                else if (state == Stream::Closing)
+                    release(stream);
+            }
+            wait(2);
+        }
+    }
+
+    void fill(Stream& stream, juce::AudioFormatManager& formats)
+    {
+        auto& sample = *stream.sample;
+        if (stream.reader == nullptr || stream.readerFile != sample.getFile())
+        {
+            stream.reader.reset(formats.createReaderFor(sample.getFile()));
+            stream.readerFile = sample.getFile();
+        }
+        if (stream.reader == nullptr)
+            return;
+
+        // Top the ring up a block at a time so one long stream cannot starve the others
+        const int remaining = (int) juce::jmin((juce::int64) std::numeric_limits<int>::max(), sample.getNumFrames() - stream.diskFrame);
+        const int count = juce::jmin(stream.fifo.getFreeSpace(), remaining, readBlockFrames);
+        if (count <= 0)
+            return;
+
+        int start1, size1, start2, size2;
+        stream.fifo.prepareToWrite(count, start1, size1, start2, size2);
+        if (size1 > 0)
+            stream.reader->read(&stream.ring, start1, size1, stream.diskFrame, true, true);
+        if (size2 > 0)
+            stream.reader->read(&stream.ring, start2, size2, stream.diskFrame + size1, true, true);
+        stream.fifo.finishedWrite(size1 + size2);
+        stream.diskFrame += size1 + size2;
+    }
+
+    // The reader stays open in case the next note on this stream plays the same file
+    static void release(Stream& stream)
+    {
+        auto* sample = std::exchange(stream.sample, nullptr);
+        sample->decReferenceCount(); // the pool still holds the sample, so this never deletes it
+        stream.state.store(Stream::Free);
+    }
+
+    std::array<Stream, (size_t) numStreams> streams;
+    juce::CriticalSection startLock;
+
+    JUCE_DECLARE_NON_COPYABLE(SampleStreamer)
+};
@@ -0,0 +1,309 @@
+#pragma once
+#include <JuceHeader.h>
+#include "SampleData.h"
+#include "SampleStreamer.h"
+#include "../dsp/Interpolation.h"
+
+// One playing instance of a SampleLayer's sample. The voice holds a reference to the
+// sample it started with, so a newly loaded sample never changes a sounding note;
+// the layer gain is applied while rendering so it can be smoothed.
+// Rendering works in chunks: a scalar pass steps the position and envelope, then the
+// interpolation kernel runs over the chunk's contiguous source frames once per source
+// channel, and the result is mixed into each output channel with the per-sample level.
+// A note pitched up an octave or more plays one of the sample's decimated mip levels,
+// so position and playbackRate are in frames of that level.
+// A streamed sample plays its resident head and then reads on from a disk stream.
+class SampleVoice
+{
+public:
+    // State a layer's voices use in turn while rendering
+    struct Shared
+    {
+        // Frames of a mapped or streamed sample, converted or copied for one chunk
+        juce::AudioBuffer<float> scratch { SampleData::maxMappedChannels, 4096 };
+        // Offline renders wait for the disk thread instead of playing missing frames as silence
+        bool waitForDisk { false };
+        // Stream reads that came up short, plus notes that found no free stream
+        std::atomic<juce::uint32> underruns { 0 };
+    };
+
+    void prepare(double sr)
+    {
+        sampleRate = sr;
+        reset();
+    }
+
+    // Returns false when a streamed sample found no free stream and will stop after its head
+    bool noteOn(const SampleData::Ptr& source, double rate, float velocity, int startPosition, SampleStreamer& streamer)
+    {
+        closeStream();
+        sample = source;
+        mipLevel = source->isMapped() ? 0 : source->getMipLevelForRate(rate);
+        numFrames = source->getNumMipFrames(mipLevel);
+        const double levelScale = 1.0 / (double) (1 << mipLevel);
+        playbackRate = rate * levelScale;
+        active = true;
+        choked = false;
+        position = (double) juce::jmax(0, startPosition) * levelScale;
+        env = juce::jlimit(0.0f, 1.0f, velocity);
+        envMult = 0.9995f;
+
+        // Without a free stream the note stops at the end of the head
+        if (source->isStreamed())
+        {
+            stream = streamer.open(*source, juce::jmax(source->getNumResidentFrames(), (int) position - maxTapsBefore));
+            if (stream == nullptr)
+            {
+                numFrames = source->getNumResidentFrames();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // gainRamp holds one value per sample of the block, or is null while the gain is static.
+    // Mapped and streamed samples are read through shared.scratch.
+    void render(juce::AudioBuffer<float>& out, int startSample, int numSamples, const float* gainRamp, float gain,
+                Shared& shared, Interpolation::Quality quality)
+    {
+        if (!active || sample == nullptr) return;
+        switch (quality)
+        {
+            case Interpolation::Cubic: renderWith<Interpolation::Cubic>(out, startSample, numSamples, gainRamp, gain, shared); break;
+            case Interpolation::Sinc:  renderWith<Interpolation::Sinc>(out, startSample, numSamples, gainRamp, gain, shared);  break;
+            default:                   renderWith<Interpolation::Linear>(out, startSample, numSamples, gainRamp, gain, shared); break;
+        }
+
+        // Drop the reference once the note ends so a replaced sample can be freed;
+        // the SamplePool still holds one, so this never deletes on the audio thread
+        if (!active)
+        {
+            closeStream();
+            sample = nullptr;
+        }
+    }
+
+    bool isActive() const { return active; }
+    float getLevel() const { return active ? env : 0.0f; }
+
+    // Fast fade-out used when the voice is choked
+    void choke()
+    {
+        choked = true;
+        envMult = std::exp(-1.0f / (0.004f * (float) sampleRate));
+    }
+
+    void reset()
+    {
+        closeStream();
+        active = false;
+        choked = false;
+        sample = nullptr;
+        mipLevel = 0;
+        numFrames = 0;
+        position = 0.0;
+        env = 0.0f;
+        envMult = 0.9995f;
+    }
+
+private:
+    static constexpr int chunkSize = 64;
+    static constexpr int maxTapsBefore = Interpolation::Taps<Interpolation::Sinc>::before;
+    static constexpr int maxDiskWaitMs = 2000;
+
+    // Where each output sample of a chunk reads from, and its level
+    struct Chunk
+    {
+        int index[chunkSize];
+        float frac[chunkSize];
+        float level[chunkSize];
+        float mono[chunkSize];
+    };
+
+    template <Interpolation::Quality Q>
+    void renderWith(juce::AudioBuffer<float>& out, int startSample, int numSamples, const float* gainRamp, float gain,
+                    Shared& shared)
+    {
+        if (gainRamp != nullptr)
+            renderBlock<Q, true>(out, startSample, numSamples, gainRamp, gain, shared);
+        else
+            renderBlock<Q, false>(out, startSample, numSamples, gainRamp, gain, shared);
+    }
+
+    template <Interpolation::Quality Q, bool Ramped>
+    void renderBlock(juce::AudioBuffer<float>& out, int startSample, int numSamples, const float* gainRamp, float gain,
+                     Shared& shared)
+    {
+        using Taps = Interpolation::Taps<Q>;
+        const bool copied = sample->isReadFromFile();
+        // A copied chunk's frames and the kernel's extra taps must fit in scratch
+        const int maxChunk = copied ? juce::jlimit(1, chunkSize, (int) ((shared.scratch.getNumSamples() - Taps::before - Taps::after - 2) / playbackRate))
+                                    : chunkSize;
+        Chunk chunk;
+        for (int done = 0; done < numSamples && active;)
+        {
+            const int n = advance<Ramped>(chunk, juce::jmin(numSamples - done, maxChunk), startSample + done, gainRamp, gain);
+            if (n > 0)
+                renderChunk<Q>(chunk, out, startSample + done, n, shared);
+            done += n;
+        }
+    }
+
+    // Steps the position and envelope through up to numSamples outputs, recording where each
+    // reads from and its level. Returns how many to render; fewer once the note ends.
+    template <bool Ramped>
+    int advance(Chunk& chunk, int numSamples, int startSample, const float* gainRamp, float gain)
+    {
+        const int srcSamples = numFrames;
+        for (int i = 0; i < numSamples; ++i)
+        {
+            const int posInt = (int) position;
+            if (posInt >= srcSamples)
+            {
+                active = false;
+                return i;
+            }
+            chunk.index[i] = posInt;
+            chunk.frac[i] = (float) (position - (double) posInt);
+            chunk.level[i] = env * (Ramped ? gainRamp[startSample + i] : gain);
+            position += playbackRate;
+            env *= envMult; // gentle decay to avoid click if long tail
+            if ((env < 1e-5f && position > srcSamples * 0.9) || (choked && env < 1e-4f))
+            {
+                active = false;
+                return i + 1;
+            }
+        }
+        return numSamples;
+    }
+
+    // Runs the kernel once per source channel over the whole chunk, then mixes it into
+    // every output channel that reads that source channel
+    template <Interpolation::Quality Q>
+    void renderChunk(Chunk& chunk, juce::AudioBuffer<float>& out, int startSample, int n, Shared& shared)
+    {
+        auto& scratch = shared.scratch;
+        using Taps = Interpolation::Taps<Q>;
+        const int srcSamples = numFrames;
+        const int first = chunk.index[0] - Taps::before;
+        const int last = chunk.index[n - 1] + Taps::after;
+
+        // frames[ch][k - base] is source frame k
+        const float* const* frames;
+        int base = 0;
+        int srcChannels = sample->getNumChannels();
+        if (sample->isMapped())
+        {
+            base = juce::jmax(0, first);
+            sample->readFrames(scratch, base, juce::jmin(srcSamples, last + 1) - base);
+            frames = scratch.getArrayOfReadPointers();
+            srcChannels = juce::jmin(srcChannels, scratch.getNumChannels());
+        }
+        else if (sample->isStreamed() && last >= sample->getNumResidentFrames())
+        {
+            base = juce::jmax(0, first);
+            readStreamed(shared, base, juce::jmin(srcSamples, last + 1) - base);
+            frames = scratch.getArrayOfReadPointers();
+            srcChannels = juce::jmin(srcChannels, scratch.getNumChannels());
+        }
+        else
+        {
+            frames = sample->getMipLevel(mipLevel).getArrayOfReadPointers();
+        }
+
+        // Only the first and last chunk of a note have taps outside the sample
+        const bool inside = first >= 0 && last < srcSamples;
+        if (inside)
+            for (int i = 0; i < n; ++i)
+                chunk.index[i] -= base;
+
+        // Samples are converted to the session rate when they load, so at zero tune the
+        // position moves in whole frames and the source frames are mixed in directly
+        const bool unity = inside && playbackRate == 1.0;
+
+        int computed = -1;
+        const float* voiced = chunk.mono;
+        for (int ch = 0; ch < out.getNumChannels(); ++ch)
+        {
+            const int srcCh = ch < srcChannels ? ch : 0;
+            if (srcCh != computed)
+            {
+                if (unity)
+                    voiced = frames[srcCh] + chunk.index[0];
+                else if (inside)
+                    Interpolation::process<Q>(frames[srcCh], chunk.index, chunk.frac, chunk.mono, n);
+                else
+                    readClamped<Q>(chunk, frames[srcCh], base, srcSamples, n);
+                computed = srcCh;
+            }
+            juce::FloatVectorOperations::addWithMultiply(out.getWritePointer(ch, startSample), voiced, chunk.level, n);
+        }
+    }
+
+    // Copies frames [start, start + count) of a streamed sample into scratch, from the
+    // head and then the stream. Frames the disk thread has not delivered yet are silent
+    // and counted as an underrun, unless the render is offline and can wait for them.
+    void readStreamed(Shared& shared, int start, int count)
+    {
+        auto& scratch = shared.scratch;
+        const int channels = juce::jmin(sample->getNumChannels(), scratch.getNumChannels());
+        const int resident = sample->getNumResidentFrames();
+        const int fromHead = juce::jlimit(0, count, resident - start);
+        for (int ch = 0; ch < channels; ++ch)
+            if (fromHead > 0)
+                scratch.copyFrom(ch, 0, sample->getBuffer(), ch, start, fromHead);
+
+        if (fromHead == count)
+            return;
+        const int tailStart = start + fromHead;
+        const int wanted = count - fromHead;
+        int ready = stream != nullptr ? stream->read(scratch, fromHead, tailStart, wanted) : 0;
+        for (int waited = 0; ready < wanted && stream != nullptr && shared.waitForDisk && waited < maxDiskWaitMs; ++waited)
+        {
+            juce::Thread::sleep(1);
+            ready += stream->read(scratch, fromHead + ready, tailStart + ready, wanted - ready);
+        }
+        if (ready < wanted)
+        {
+            ++shared.underruns;
+            for (int ch = 0; ch < channels; ++ch)
+                juce::FloatVectorOperations::clear(scratch.getWritePointer(ch, fromHead + ready), wanted - ready);
+        }
+
+        // Later chunks never reach further back than the kernel's taps behind the position
+        if (stream != nullptr)
+            stream->discardBefore((int) position - maxTapsBefore);
+    }
+
+    void closeStream()
+    {
+        if (stream != nullptr)
+            SampleStreamer::close(*std::exchange(stream, nullptr));
+    }
+
+    // Kernel taps past either end of the sample repeat the edge frame
+    template <Interpolation::Quality Q>
+    static void readClamped(Chunk& chunk, const float* frames, int base, int srcSamples, int n)
+    {
+        using Taps = Interpolation::Taps<Q>;
+        float taps[Taps::before + Taps::after + 1];
+        for (int i = 0; i < n; ++i)
+        {
+            for (int k = -Taps::before; k <= Taps::after; ++k)
+                taps[k + Taps::before] = frames[juce::jlimit(0, srcSamples - 1, chunk.index[i] + k) - base];
+            chunk.mono[i] = Interpolation::read<Q>(taps + Taps::before, chunk.frac[i]);
+        }
+    }
+
+    SampleData::Ptr sample;
+    SampleStreamer::Stream* stream { nullptr };
+    double sampleRate { 44100.0 };
+    double playbackRate { 1.0 };
+    double position { 0.0 };
+    int mipLevel { 0 };
+    int numFrames { 0 };
+    float env { 0.0f };
+    float envMult { 0.9995f };
+    bool active { false };
+    bool choked { false };
+};
@@ -0,0 +1,146 @@
+#pragma once
+#include <JuceHeader.h>
+#include "SamplePool.h"
+
+// The samples a lane plays, as velocity layers that each hold one or more round-robin
+// variants. A single file is a map with one layer and one variant. Like SampleData
+// it is never modified once built, so the audio thread reads it while the loading
+// thread builds its replacement.
+//
+// Folders are mapped from their file names. A "v<n>" token sets the velocity layer
+// and an "rr<n>" token the round-robin position, e.g. "Snare_v2_rr3.wav".
+// Velocity numbers up to maxVelocityLayers are layer indices and split the velocity
+// range evenly. Higher numbers are the top MIDI velocity of their layer, so with
+// "Snare_v110" and "Snare_v127" the sequencer's normal steps (0.8, about MIDI 102)
+// play the first and accents the second.
+class SampleZoneMap : public juce::ReferenceCountedObject
+{
+public:
+    using Ptr = juce::ReferenceCountedObjectPtr<SampleZoneMap>;
+
+    static constexpr int maxVelocityLayers = 16;
+
+    struct VelocityLayer
+    {
+        float maxVelocity;                          // highest velocity played by this layer
+        std::vector<SampleData::Ptr> roundRobin;
+    };
+
+    // Blocks while loading, so never call it on the audio thread
+    static Ptr fromFile(SamplePool& pool, const juce::File& file, SampleData::Storage storage)
+    {
+        auto data = pool.load(file, storage);
+        if (data == nullptr)
+            return nullptr;
+        return new SampleZoneMap({ { 1.0f, { data } } });
+    }
+
+    // Loads every audio file in folder; files whose names do not parse play in the
+    // lowest layer, ordered by name. Null when nothing in the folder loads.
+    static Ptr fromFolder(SamplePool& pool, const juce::File& folder, SampleData::Storage storage)
+    {
+        struct Zone { int velocity; int roundRobin; juce::String name; SampleData::Ptr data; };
+        std::vector<Zone> zones;
+        for (const auto& file : folder.findChildFiles(juce::File::findFiles, false, "*.wav;*.aif;*.aiff;*.flac;*.ogg"))
+        {
+            if (auto data = pool.load(file, storage))
+            {
+                const auto name = file.getFileNameWithoutExtension();
+                zones.push_back({ parseToken(name, "v"), parseToken(name, "rr"), name, data });
+            }
+        }
+        if (zones.empty())
+            return nullptr;
+
+        const auto byZone = [](const Zone& a, const Zone& b)
+        {
+            if (a.velocity != b.velocity) return a.velocity < b.velocity;
+            if (a.roundRobin != b.roundRobin) return a.roundRobin < b.roundRobin;
+            return a.name < b.name;
+        };
+        std::sort(zones.begin(), zones.end(), byZone);
+
+        // Small numbers are indices; a larger one anywhere makes them all MIDI velocities.
+        // As a MIDI velocity, the 0 of a file without a number would make a layer that
+        // never plays, so those files join the lowest numbered layer instead.
+        const bool midiVelocities = zones.back().velocity > maxVelocityLayers;
+        if (midiVelocities && zones.front().velocity == 0)
+        {
+            const int lowest = std::find_if(zones.begin(), zones.end(), [](const Zone& z) { return z.velocity > 0; })->velocity;
+            for (auto& zone : zones)
+                if (zone.velocity == 0)
+                    zone.velocity = lowest;
+            std::sort(zones.begin(), zones.end(), byZone);
+        }
+
+        std::vector<VelocityLayer> layers;
+        for (const auto& zone : zones)
+        {
+            if (layers.empty() || layers.back().maxVelocity != (float) zone.velocity)
+            {
+                if ((int) layers.size() == maxVelocityLayers)
+                    break;
+                layers.push_back({ (float) zone.velocity, {} });
+            }
+            layers.back().roundRobin.push_back(zone.data);
+        }
+
+        for (size_t i = 0; i < layers.size(); ++i)
+            layers[i].maxVelocity = midiVelocities ? juce::jlimit(0.0f, 1.0f, layers[i].maxVelocity / 127.0f)
+                                                   : (float) (i + 1) / (float) layers.size();
+        layers.back().maxVelocity = 1.0f;
+        return new SampleZoneMap(std::move(layers));
+    }
+
+    // The same zones with every sample converted to sampleRate through the pool.
+    // Blocks while converting, so never call it on the audio thread.
+    Ptr withSampleRate(SamplePool& pool, double sampleRate) const
+    {
+        auto converted = layers;
+        for (auto& layer : converted)
+            for (auto& data : layer.roundRobin)
+                data = pool.getForRate(data, sampleRate);
+        return new SampleZoneMap(std::move(converted));
+    }
+
+    int getNumLayers() const { return (int) layers.size(); }
+    const VelocityLayer& getLayer(int index) const { return layers[(size_t) index]; }
+
+    // Lowest layer whose range reaches velocity
+    int findLayer(float velocity) const
+    {
+        for (size_t i = 0; i + 1 < layers.size(); ++i)
+            if (velocity <= layers[i].maxVelocity)
+                return (int) i;
+        return (int) layers.size() - 1;
+    }
+
+    // True when any zone reads its frames from the file while playing
+    bool hasStreamedSamples() const
+    {
+        for (const auto& layer : layers)
+            for (const auto& data : layer.roundRobin)
+                if (data->isStreamed())
+                    return true;
+        return false;
+    }
+
+private:
+    explicit SampleZoneMap(std::vector<VelocityLayer> zoneLayers) : layers(std::move(zoneLayers)) {}
+
+    // Number after a prefix token such as "v3" or "rr2", or 0 when there is none
+    static int parseToken(const juce::String& name, const juce::String& prefix)
+    {
+        for (const auto& token : juce::StringArray::fromTokens(name.toLowerCase(), "_- .", ""))
+        {
+            const auto digits = token.substring(prefix.length());
+            if (token.startsWith(prefix) && digits.isNotEmpty() && digits.containsOnly("0123456789"))
+                return digits.getIntValue();
+        }
+        return 0;
+    }
+
+    const std::vector<VelocityLayer> layers;
+
+    JUCE_DECLARE_NON_COPYABLE(SampleZoneMap)
+};
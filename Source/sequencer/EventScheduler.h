@@ -0,0 +1,96 @@
+#pragma once
+#include <JuceHeader.h>
+#include "StepLocks.h"
+
+// One hit for the current block: which lane, when, how hard, and the step's locks.
+struct ScheduledEvent
+{
+    int sampleOffset;
+    int lane;
+    float velocity;
+    StepLocks locks;
+};
+
+// Collects sequencer triggers and incoming MIDI notes for one block and hands
+// them back in time order, so the processor can render voices in sub-blocks
+// between events. Capacity is fixed in reserve(); the audio thread never allocates.
+class EventScheduler
+{
+public:
+    void reserve(int capacity)
+    {
+        storage.resize((size_t) juce::jmax(1, capacity));
+        scratch.resize(storage.size());
+        count = 0;
+    }
+
+    void clear() { count = 0; }
+
+    bool add(int sampleOffset, int lane, float velocity, const StepLocks& locks = {})
+    {
+        if (count >= (int) storage.size())
+        {
+            jassertfalse; // more events in one block than reserved for
+            return false;
+        }
+        storage[(size_t) count++] = { sampleOffset, lane, velocity, locks };
+        return true;
+    }
+
+    // Stable: events at the same sample keep the order they were added in. Short
+    // lists, where each source arrives already ordered, use an insertion sort; ratchets
+    // can fill a block with hundreds of hits, so longer ones use a bottom-up merge
+    // sort through the scratch buffer reserved alongside the storage.
+    void sort()
+    {
+        if (count <= insertionSortLimit)
+        {
+            insertionSort();
+            return;
+        }
+
+        auto* from = storage.data();
+        auto* to = scratch.data();
+        for (int width = 1; width < count; width *= 2)
+        {
+            for (int lo = 0; lo < count; lo += 2 * width)
+            {
+                const int mid = juce::jmin(lo + width, count);
+                const int hi = juce::jmin(lo + 2 * width, count);
+                std::merge(from + lo, from + mid, from + mid, from + hi, to + lo,
+                           [](const ScheduledEvent& a, const ScheduledEvent& b) { return a.sampleOffset < b.sampleOffset; });
+            }
+            std::swap(from, to);
+        }
+        if (from != storage.data())
+            std::copy(from, from + count, storage.data());
+    }
+
+    int size() const { return count; }
+    const ScheduledEvent& operator[](int index) const { return storage[(size_t) index]; }
+
+    const ScheduledEvent* begin() const { return storage.data(); }
+    const ScheduledEvent* end() const   { return storage.data() + count; }
+
+private:
+    static constexpr int insertionSortLimit = 32;
+
+    void insertionSort()
+    {
+        for (int i = 1; i < count; ++i)
+        {
+            const auto e = storage[(size_t) i];
+            int j = i - 1;
+            while (j >= 0 && storage[(size_t) j].sampleOffset > e.sampleOffset)
+            {
+                storage[(size_t) (j + 1)] = storage[(size_t) j];
+                --j;
+            }
+            storage[(size_t) (j + 1)] = e;
+        }
+    }
+
+    std::vector<ScheduledEvent> storage;
+    std::vector<ScheduledEvent> scratch;  // merge sort buffer, the size of storage
+    int count { 0 };
+};
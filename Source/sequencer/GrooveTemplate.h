@@ -0,0 +1,265 @@
+#pragma once
+#include <JuceHeader.h>
+
+// A groove: timing and velocity offsets per 1/16 slot over one or two bars, like the
+// swing and groove templates of MPC-style machines. Timing is a fraction of a slot
+// (positive is late); velocity is a relative change (0.1 plays 10% harder).
+struct GrooveTemplate
+{
+    static constexpr int slotsPerBar = 16;
+    static constexpr int maxSlots = 2 * slotsPerBar;
+    static constexpr float maxTiming = 0.45f;
+    static constexpr float maxVelocity = 0.5f;
+
+    int slots { slotsPerBar };
+    std::array<float, (size_t) maxSlots> timing {};
+    std::array<float, (size_t) maxSlots> velocity {};
+
+    // The built-ins, in the order of the Groove parameter's choices; Extracted follows them
+    enum BuiltIn { Off, Mpc54, Mpc58, Mpc62, Mpc66, Mpc71, LaidBack, Push, NumBuiltIns };
+
+    static GrooveTemplate makeBuiltIn(int index)
+    {
+        GrooveTemplate g;
+        auto every = [&g](int first, int step, float timing, float velocity)
+        {
+            for (int s = first; s < g.slots; s += step)
+            {
+                g.timing[(size_t) s] += timing;
+                g.velocity[(size_t) s] += velocity;
+            }
+        };
+
+        // MPC swing percentages place the second 1/16 of each 1/8 at that share of it
+        const float mpcSwing[] = { 0.54f, 0.58f, 0.62f, 0.66f, 0.71f };
+        if (index >= Mpc54 && index <= Mpc71)
+            every(1, 2, 2.0f * mpcSwing[index - Mpc54] - 1.0f, 0.0f);
+        else if (index == LaidBack)
+        {
+            every(1, 2, 0.06f, -0.15f);    // late, soft ghost 1/16s
+            every(4, 8, 0.12f, 0.1f);      // dragged backbeats
+        }
+        else if (index == Push)
+        {
+            every(1, 2, -0.04f, -0.1f);
+            every(2, 4, -0.08f, 0.1f);     // rushed off-beat 1/8s
+        }
+        return g;
+    }
+
+    // A hit found in a loop, at a position in slots from the loop start
+    struct Onset
+    {
+        double position;
+        float level;
+    };
+
+    // Averages the hits falling nearest each slot. Loops of an even number of bars
+    // make a two-bar groove, others fold onto one bar. Slots without hits stay on
+    // the grid; velocities are relative to the loop's average level.
+    static bool fromOnsets(const std::vector<Onset>& onsets, double lengthSlots, GrooveTemplate& out)
+    {
+        if (onsets.empty())
+            return false;
+
+        const int bars = juce::jmax(1, juce::roundToInt(lengthSlots / slotsPerBar));
+        GrooveTemplate g;
+        g.slots = bars % 2 == 0 ? maxSlots : slotsPerBar;
+
+        std::array<int, (size_t) maxSlots> counts {};
+        std::array<double, (size_t) maxSlots> levels {};
+        double totalLevel = 0.0;
+        for (const auto& onset : onsets)
+        {
+            const auto nearest = (juce::int64) std::llround(onset.position);
+            const auto slot = (size_t) (((nearest % g.slots) + g.slots) % g.slots);
+            g.timing[slot] += (float) (onset.position - (double) nearest);
+            levels[slot] += onset.level;
+            totalLevel += onset.level;
+            ++counts[slot];
+        }
+
+        const double meanLevel = totalLevel / (double) onsets.size();
+        for (size_t s = 0; s < (size_t) g.slots; ++s)
+        {
+            if (counts[s] == 0)
+                continue;
+            g.timing[s] = juce::jlimit(-maxTiming, maxTiming, g.timing[s] / (float) counts[s]);
+            if (meanLevel > 0.0)
+                g.velocity[s] = juce::jlimit(-maxVelocity, maxVelocity, (float) (levels[s] / counts[s] / meanLevel - 1.0));
+        }
+        out = g;
+        return true;
+    }
+
+    // Note-ons of every track, at the velocity they were played with. The loop runs to
+    // the end of the bar holding the last event.
+    static bool extractFromMidiFile(const juce::File& file, GrooveTemplate& out)
+    {
+        juce::FileInputStream in(file);
+        juce::MidiFile midi;
+        if (! in.openedOk() || ! midi.readFrom(in))
+            return false;
+
+        const int ticksPerQuarter = midi.getTimeFormat();
+        if (ticksPerQuarter <= 0)
+            return false;  // SMPTE time has no beats to place hits against
+
+        const double ticksPerSlot = ticksPerQuarter / 4.0;
+        std::vector<Onset> onsets;
+        for (int t = 0; t < midi.getNumTracks(); ++t)
+            for (const auto* event : *midi.getTrack(t))
+                if (event->message.isNoteOn())
+                    onsets.push_back({ event->message.getTimeStamp() / ticksPerSlot, event->message.getFloatVelocity() });
+
+        const double bars = std::ceil(midi.getLastTimestamp() / ticksPerSlot / slotsPerBar - 1.0e-6);
+        return fromOnsets(onsets, juce::jmax(1.0, bars) * slotsPerBar, out);
+    }
+
+    // Reads up to a minute of an audio loop
+    static bool extractFromAudioFile(const juce::File& file, double bpm, GrooveTemplate& out)
+    {
+        juce::AudioFormatManager formats;
+        formats.registerBasicFormats();
+        std::unique_ptr<juce::AudioFormatReader> reader(formats.createReaderFor(file));
+        if (reader == nullptr || reader->sampleRate <= 0.0)
+            return false;
+
+        const int length = (int) juce::jmin(reader->lengthInSamples, (juce::int64) (reader->sampleRate * 60.0));
+        if (length <= 0)
+            return false;
+        juce::AudioBuffer<float> buffer((int) reader->numChannels, length);
+        reader->read(&buffer, 0, length, 0, true, true);
+        return extractFromAudio(buffer, reader->sampleRate, bpm, out);
+    }
+
+    // Finds hits as sharp rises in short-term level. The loop is taken to be a whole
+    // number of bars near bpm, and the hits are stretched to fit them exactly.
+    static bool extractFromAudio(const juce::AudioBuffer<float>& buffer, double sampleRate, double bpm, GrooveTemplate& out)
+    {
+        const int length = buffer.getNumSamples();
+        if (length <= 0 || buffer.getNumChannels() <= 0 || sampleRate <= 0.0 || bpm <= 0.0)
+            return false;
+
+        // RMS level over hops of 5 ms
+        const int hop = juce::jmax(1, juce::roundToInt(sampleRate * 0.005));
+        std::vector<float> levels;
+        for (int start = 0; start < length; start += hop)
+        {
+            const int n = juce::jmin(hop, length - start);
+            float sum = 0.0f;
+            for (int ch = 0; ch < buffer.getNumChannels(); ++ch)
+            {
+                const float rms = buffer.getRMSLevel(ch, start, n);
+                sum += rms * rms;
+            }
+            levels.push_back(std::sqrt(sum / (float) buffer.getNumChannels()));
+        }
+        const float peak = *std::max_element(levels.begin(), levels.end());
+        if (peak <= 0.0f)
+            return false;
+
+        const double lengthSlots = length * bpm / 60.0 * 4.0 / sampleRate;
+        const double bars = juce::jmax(1.0, (double) juce::roundToInt(lengthSlots / slotsPerBar));
+        const double slotsPerSample = bars * slotsPerBar / length;
+
+        // A hit is a hop well above the two before it, at least 50 ms after the last hit.
+        // It starts at the first sample around that hop to reach half its peak.
+        const int minGap = juce::roundToInt(0.05 * sampleRate / hop);
+        int lastHit = -minGap;
+        std::vector<Onset> onsets;
+        for (int i = 0; i < (int) levels.size(); ++i)
+        {
+            const float before = juce::jmax(i > 0 ? levels[(size_t) i - 1] : 0.0f, i > 1 ? levels[(size_t) i - 2] : 0.0f);
+            if (levels[(size_t) i] < 0.1f * peak || levels[(size_t) i] < 2.0f * before || i - lastHit < minGap)
+                continue;
+            lastHit = i;
+
+            const int from = juce::jmax(0, i - 1) * hop, to = juce::jmin(length, (i + 1) * hop);
+            float windowPeak = 0.0f;
+            for (int ch = 0; ch < buffer.getNumChannels(); ++ch)
+                windowPeak = juce::jmax(windowPeak, buffer.getMagnitude(ch, from, to - from));
+            auto reachesHalfPeak = [&](int sample)
+            {
+                for (int ch = 0; ch < buffer.getNumChannels(); ++ch)
+                    if (std::abs(buffer.getSample(ch, sample)) >= 0.5f * windowPeak)
+                        return true;
+                return false;
+            };
+            int start = from;
+            while (start < to - 1 && ! reachesHalfPeak(start))
+                ++start;
+
+            // The hit's level is its peak over the next 20 ms
+            const int peakLength = juce::jmin(length - start, juce::roundToInt(0.02 * sampleRate));
+            float hitPeak = 0.0f;
+            for (int ch = 0; ch < buffer.getNumChannels(); ++ch)
+                hitPeak = juce::jmax(hitPeak, buffer.getMagnitude(ch, start, peakLength));
+            onsets.push_back({ start * slotsPerSample, hitPeak });
+        }
+        return fromOnsets(onsets, bars * slotsPerBar, out);
+    }
+
+    // MIDI files by extension, anything else as audio
+    static bool extractFromFile(const juce::File& file, double bpm, GrooveTemplate& out)
+    {
+        return file.hasFileExtension("mid;midi") ? extractFromMidiFile(file, out)
+                                                 : extractFromAudioFile(file, bpm, out);
+    }
+};
+
+// A groove compiled for playback: the offset in ticks and the velocity scale of a step
+// starting at each tick position over two bars. Every step division is a multiple of
+// resolutionTicks, so a lane finds its steps' entries by position alone and playing a
+// groove is a table read.
+struct GrooveTable
+{
+    static constexpr int ticksPerSlot = 240;    // 1/16 at 960 ticks per quarter
+    static constexpr int resolutionTicks = 40;
+    static constexpr int numPositions = GrooveTemplate::maxSlots * ticksPerSlot / resolutionTicks;
+
+    int id { 0 };   // changes whenever the contents do
+    std::array<float, (size_t) numPositions> offsetTicks {};
+    std::array<float, (size_t) numPositions> velocityScale;
+    float maxEarlyTicks { 0.0f }, maxLateTicks { 0.0f };
+
+    GrooveTable() { velocityScale.fill(1.0f); }
+
+    static int getPosition(int stepTick) { return stepTick / resolutionTicks % numPositions; }
+
+    // Positions between slots, such as triplet steps, blend the slots either side
+    void compile(const GrooveTemplate& groove, int newId)
+    {
+        id = newId;
+        maxEarlyTicks = maxLateTicks = 0.0f;
+        const int slots = juce::jlimit(1, GrooveTemplate::maxSlots, groove.slots);
+        for (int p = 0; p < numPositions; ++p)
+        {
+            const double slotPosition = std::fmod((double) p * resolutionTicks / ticksPerSlot, (double) slots);
+            const auto before = (size_t) slotPosition;
+            const auto after = (before + 1) % (size_t) slots;
+            const auto blend = (float) (slotPosition - (double) before);
+            const float timing = groove.timing[before] + blend * (groove.timing[after] - groove.timing[before]);
+            const float velocity = groove.velocity[before] + blend * (groove.velocity[after] - groove.velocity[before]);
+
+            offsetTicks[(size_t) p] = timing * ticksPerSlot;
+            velocityScale[(size_t) p] = 1.0f + velocity;
+            maxEarlyTicks = juce::jmax(maxEarlyTicks, -offsetTicks[(size_t) p]);
+            maxLateTicks = juce::jmax(maxLateTicks, offsetTicks[(size_t) p]);
+        }
+    }
+
+    // This table as full at a strength of 0 to 1. Rewrites the fixed arrays in place,
+    // so the audio thread can follow the strength parameter.
+    void setScaled(const GrooveTable& full, float strength)
+    {
+        id = full.id;
+        for (size_t p = 0; p < (size_t) numPositions; ++p)
+        {
+            offsetTicks[p] = strength * full.offsetTicks[p];
+            velocityScale[p] = 1.0f + strength * (full.velocityScale[p] - 1.0f);
+        }
+        maxEarlyTicks = strength * full.maxEarlyTicks;
+        maxLateTicks = strength * full.maxLateTicks;
+    }
+};
@@ -0,0 +1,329 @@
+#pragma once
+#include <JuceHeader.h>
+#include "StepSequencer.h"
+#include "SongTimeline.h"
+#include "GrooveTemplate.h"
+
+// Binary form of every lane's patterns, the song chain and the extracted groove,
+// stored in the plugin state ahead of the parameter tree. All values are little-endian:
+//
+//   int magic 'DMPT', int version, int payload bytes
+//   byte lane count, then per lane:
+//     short lane bytes
+//     the selected pattern: short step count, then (step count + 63) / 64 pairs
+//       of int64 on bits and int64 accent bits
+//     version 2: byte selected index, byte bank size, then each bank pattern as above
+//     version 3: the locks of the selected pattern, then of each bank pattern: short
+//       lock count, then per locked step byte step, byte parameter mask, 4 floats
+//     version 4: byte step division of the selected pattern, then of each bank pattern
+//     version 5: the step timing of the selected pattern, then of each bank pattern:
+//       short count of steps with a ratchet or microtiming, then per step byte step,
+//       byte extra hits, signed byte ramp percent, signed byte microtiming
+//   version 2: short chain length, then per entry byte pattern, short repeats
+//   version 6: the extracted groove: byte slot count, then per slot float timing,
+//     float velocity
+//
+// Later versions append fields to the end of a lane or of the payload. Readers
+// skip what they do not know, so older builds still load the steps of newer states.
+namespace PatternChunk
+{
+    static constexpr int magic = 'D' | ('M' << 8) | ('P' << 16) | ('T' << 24);
+    static constexpr int version = 6;
+    static constexpr int headerBytes = 3 * (int) sizeof(int);
+
+    namespace detail
+    {
+        inline int getNumWords(int steps) { return (steps + 63) / 64; }
+        inline int getPatternBytes(const StepSequencer::Pattern& p) { return 2 + 16 * getNumWords(p.steps); }
+
+        static constexpr int lockBytes = 2 + 4 * StepLocks::NumParams;
+        inline int getLocksBytes(const StepSequencer::Pattern& p) { return 2 + lockBytes * StepSequencer::getNumLocks(p); }
+
+        static constexpr int timingBytes = 4;
+
+        inline bool hasTiming(const StepSequencer::Pattern& p, int step)
+        {
+            return p.ratchets[(size_t) step] != 0 || p.ramps[(size_t) step] != 0 || p.microTiming[(size_t) step] != 0;
+        }
+
+        inline int getNumTimed(const StepSequencer::Pattern& p)
+        {
+            int count = 0;
+            for (int k = 0; k < p.steps; ++k)
+                count += hasTiming(p, k) ? 1 : 0;
+            return count;
+        }
+
+        inline int getTimingBytes(const StepSequencer::Pattern& p) { return 2 + timingBytes * getNumTimed(p); }
+
+        inline void writePattern(juce::OutputStream& out, const StepSequencer::Pattern& p)
+        {
+            out.writeShort((short) p.steps);
+            for (int w = 0; w < getNumWords(p.steps); ++w)
+            {
+                out.writeInt64((juce::int64) p.on[(size_t) w]);
+                out.writeInt64((juce::int64) p.accent[(size_t) w]);
+            }
+        }
+
+        // Reads a pattern that must end by endPosition; false when it would not
+        inline bool readPattern(juce::MemoryInputStream& in, juce::int64 endPosition, StepSequencer::Pattern& p)
+        {
+            if (in.getPosition() + 2 > endPosition)
+                return false;
+            p = {};
+            p.steps = (juce::uint16) in.readShort();
+            const int words = getNumWords(p.steps);
+            if (in.getPosition() + 16 * words > endPosition)
+                return false;
+            for (int w = 0; w < words; ++w)
+            {
+                const auto on = (juce::uint64) in.readInt64();
+                const auto accent = (juce::uint64) in.readInt64();
+                if (w < StepSequencer::numWords)
+                {
+                    p.on[(size_t) w] = on;
+                    p.accent[(size_t) w] = accent;
+                }
+            }
+            return true;
+        }
+
+        inline void writeLocks(juce::OutputStream& out, const StepSequencer::Pattern& p)
+        {
+            out.writeShort((short) StepSequencer::getNumLocks(p));
+            int slot = 0;
+            for (int w = 0; w < StepSequencer::numWords; ++w)
+            {
+                for (auto mask = p.locked[(size_t) w]; mask != 0; mask &= mask - 1)
+                {
+                    const auto& locks = p.locks[(size_t) slot++];
+                    out.writeByte((char) (w * 64 + BitOps::countTrailingZeros(mask)));
+                    out.writeByte((char) locks.mask);
+                    for (auto value : locks.values)
+                        out.writeFloat(value);
+                }
+            }
+        }
+
+        // Adds the locks to a pattern read before; false when they would not end by endPosition
+        inline bool readLocks(juce::MemoryInputStream& in, juce::int64 endPosition, StepSequencer::Pattern& p)
+        {
+            if (in.getPosition() + 2 > endPosition)
+                return false;
+            const int count = (juce::uint16) in.readShort();
+            if (in.getPosition() + (juce::int64) lockBytes * count > endPosition)
+                return false;
+            for (int i = 0; i < count; ++i)
+            {
+                const int step = (juce::uint8) in.readByte();
+                StepLocks locks;
+                locks.mask = (juce::uint8) (in.readByte() & ((1 << StepLocks::NumParams) - 1));
+                for (auto& value : locks.values)
+                    value = in.readFloat();
+                if (step < StepSequencer::maxSteps)
+                    StepSequencer::setStepLocks(p, step, locks);
+            }
+            return true;
+        }
+
+        inline void writeTiming(juce::OutputStream& out, const StepSequencer::Pattern& p)
+        {
+            out.writeShort((short) getNumTimed(p));
+            for (int k = 0; k < p.steps; ++k)
+            {
+                if (hasTiming(p, k))
+                {
+                    out.writeByte((char) k);
+                    out.writeByte((char) p.ratchets[(size_t) k]);
+                    out.writeByte((char) p.ramps[(size_t) k]);
+                    out.writeByte((char) p.microTiming[(size_t) k]);
+                }
+            }
+        }
+
+        // Adds the step timing to a pattern read before; false when it would not end
+        // by endPosition. Values are clamped as the setters would.
+        inline bool readTiming(juce::MemoryInputStream& in, juce::int64 endPosition, StepSequencer::Pattern& p)
+        {
+            if (in.getPosition() + 2 > endPosition)
+                return false;
+            const int count = (juce::uint16) in.readShort();
+            if (in.getPosition() + (juce::int64) timingBytes * count > endPosition)
+                return false;
+            for (int i = 0; i < count; ++i)
+            {
+                const int step = (juce::uint8) in.readByte();
+                const int ratchets = (juce::uint8) in.readByte();
+                const int ramp = (juce::int8) in.readByte();
+                const int micro = (juce::int8) in.readByte();
+                if (step < StepSequencer::maxSteps)
+                {
+                    p.ratchets[(size_t) step] = (juce::uint8) juce::jmin(ratchets, StepSequencer::maxRatchets - 1);
+                    p.ramps[(size_t) step] = (juce::int8) juce::jlimit(-100, 100, ramp);
+                    p.microTiming[(size_t) step] = (juce::int8) juce::jlimit(-StepSequencer::maxMicroTiming, StepSequencer::maxMicroTiming, micro);
+                }
+            }
+            return true;
+        }
+    }
+
+    inline void write(juce::OutputStream& out, StepSequencer* const* lanes, int numLanes, const SongChain& chain,
+                      const GrooveTemplate& groove)
+    {
+        auto getLaneBytes = [](const StepSequencer& seq)
+        {
+            const auto& current = seq.getPattern(seq.getSelectedPattern());
+            int bytes = detail::getPatternBytes(current) + 2 + detail::getLocksBytes(current) + 1 + detail::getTimingBytes(current);
+            for (int p = 0; p < StepSequencer::numPatterns; ++p)
+            {
+                const auto& pattern = seq.getPattern(p);
+                bytes += detail::getPatternBytes(pattern) + detail::getLocksBytes(pattern) + 1 + detail::getTimingBytes(pattern);
+            }
+            return bytes;
+        };
+
+        int payloadBytes = 1 + 2 + 3 * (int) chain.size() + 1 + 8 * groove.slots;
+        for (int lane = 0; lane < numLanes; ++lane)
+            payloadBytes += 2 + getLaneBytes(*lanes[lane]);
+
+        out.writeInt(magic);
+        out.writeInt(version);
+        out.writeInt(payloadBytes);
+        out.writeByte((char) numLanes);
+        for (int lane = 0; lane < numLanes; ++lane)
+        {
+            const auto& seq = *lanes[lane];
+            out.writeShort((short) getLaneBytes(seq));
+            detail::writePattern(out, seq.getPattern(seq.getSelectedPattern()));
+            out.writeByte((char) seq.getSelectedPattern());
+            out.writeByte((char) StepSequencer::numPatterns);
+            for (int p = 0; p < StepSequencer::numPatterns; ++p)
+                detail::writePattern(out, seq.getPattern(p));
+            detail::writeLocks(out, seq.getPattern(seq.getSelectedPattern()));
+            for (int p = 0; p < StepSequencer::numPatterns; ++p)
+                detail::writeLocks(out, seq.getPattern(p));
+            out.writeByte((char) seq.getPattern(seq.getSelectedPattern()).division);
+            for (int p = 0; p < StepSequencer::numPatterns; ++p)
+                out.writeByte((char) seq.getPattern(p).division);
+            detail::writeTiming(out, seq.getPattern(seq.getSelectedPattern()));
+            for (int p = 0; p < StepSequencer::numPatterns; ++p)
+                detail::writeTiming(out, seq.getPattern(p));
+        }
+
+        out.writeShort((short) chain.size());
+        for (const auto& entry : chain)
+        {
+            out.writeByte((char) entry.pattern);
+            out.writeShort((short) entry.repeats);
+        }
+
+        out.writeByte((char) groove.slots);
+        for (int s = 0; s < groove.slots; ++s)
+        {
+            out.writeFloat(groove.timing[(size_t) s]);
+            out.writeFloat(groove.velocity[(size_t) s]);
+        }
+    }
+
+    // Restores the lanes, the chain and the groove from a chunk at the start of data
+    // and returns the bytes it took up, or 0 when data does not start with a chunk
+    // (such as a legacy state). A version 1 chunk restores only the selected pattern
+    // and leaves the chain alone; chunks before version 6 leave the groove alone.
+    inline size_t read(const void* data, size_t size, StepSequencer* const* lanes, int numLanes, SongChain& chain,
+                       GrooveTemplate& groove)
+    {
+        juce::MemoryInputStream in(data, size, false);
+        if (size < (size_t) headerBytes || in.readInt() != magic)
+            return 0;
+
+        const int chunkVersion = in.readInt();
+        const int payloadBytes = in.readInt();
+        if (chunkVersion < 1 || payloadBytes < 1 || (size_t) payloadBytes > size - (size_t) headerBytes)
+            return 0;
+
+        const juce::int64 payloadEnd = headerBytes + payloadBytes;
+        const int chunkLanes = (juce::uint8) in.readByte();
+        for (int lane = 0; lane < chunkLanes; ++lane)
+        {
+            if (in.getPosition() + 2 > payloadEnd)
+                break;
+            const int laneBytes = (juce::uint16) in.readShort();
+            const auto laneEnd = in.getPosition() + laneBytes;
+            if (laneEnd > payloadEnd)
+                break;
+
+            // The selected pattern, then the bank; each later field follows for all of
+            // them in turn, and reading stops at the first one that is cut short
+            std::vector<StepSequencer::Pattern> patterns (1);
+            if (lane < numLanes && detail::readPattern(in, laneEnd, patterns[0]))
+            {
+                int selected = -1;
+                if (chunkVersion >= 2 && in.getPosition() + 2 <= laneEnd)
+                {
+                    selected = (juce::uint8) in.readByte();
+                    const int bankSize = (juce::uint8) in.readByte();
+                    StepSequencer::Pattern pattern;
+                    for (int p = 0; p < bankSize && detail::readPattern(in, laneEnd, pattern); ++p)
+                        patterns.push_back(pattern);
+                }
+                bool intact = true;
+                auto readForEach = [&](int sinceVersion, auto&& readField)
+                {
+                    for (auto& pattern : patterns)
+                        intact = intact && chunkVersion >= sinceVersion && readField(pattern);
+                };
+                readForEach(3, [&](StepSequencer::Pattern& p) { return detail::readLocks(in, laneEnd, p); });
+                readForEach(4, [&](StepSequencer::Pattern& p)
+                {
+                    if (in.getPosition() + 1 > laneEnd)
+                        return false;
+                    p.division = (juce::uint8) in.readByte();
+                    return true;
+                });
+                readForEach(5, [&](StepSequencer::Pattern& p) { return detail::readTiming(in, laneEnd, p); });
+
+                auto& seq = *lanes[lane];
+                seq.applyEdits([&]
+                {
+                    for (int p = 1; p < (int) patterns.size() && p <= StepSequencer::numPatterns; ++p)
+                        seq.setPattern(p - 1, patterns[(size_t) p]);
+                    if (selected >= 0)
+                        seq.selectPattern(selected);
+                    seq.setPattern(seq.getSelectedPattern(), patterns[0]);
+                });
+            }
+            in.setPosition(laneEnd);
+        }
+
+        if (chunkVersion >= 2 && in.getPosition() + 2 <= payloadEnd)
+        {
+            const int entries = (juce::uint16) in.readShort();
+            chain.clear();
+            for (int i = 0; i < entries && in.getPosition() + 3 <= payloadEnd; ++i)
+            {
+                const int pattern = (juce::uint8) in.readByte();
+                const int repeats = (juce::uint16) in.readShort();
+                if (pattern < StepSequencer::numPatterns && repeats > 0)
+                    chain.push_back({ pattern, repeats });
+            }
+        }
+
+        if (chunkVersion >= 6 && in.getPosition() + 1 <= payloadEnd)
+        {
+            const int slots = (juce::uint8) in.readByte();
+            if (slots >= 1 && slots <= GrooveTemplate::maxSlots && in.getPosition() + 8 * slots <= payloadEnd)
+            {
+                GrooveTemplate restored;
+                restored.slots = slots;
+                for (int s = 0; s < slots; ++s)
+                {
+                    restored.timing[(size_t) s] = juce::jlimit(-GrooveTemplate::maxTiming, GrooveTemplate::maxTiming, in.readFloat());
+                    restored.velocity[(size_t) s] = juce::jlimit(-GrooveTemplate::maxVelocity, GrooveTemplate::maxVelocity, in.readFloat());
+                }
+                groove = restored;
+            }
+        }
+        return (size_t) payloadEnd;
+    }
+}
@@ -0,0 +1,301 @@
+#pragma once
+#include <JuceHeader.h>
+#include "StepSequencer.h"
+#include "TriggerQueue.h"
+
+// Song mode: a chain of bank patterns, each played a number of times. The chain is
+// compiled on the message thread: every bank pattern it plays becomes one pass, a list
+// of hits sorted by tick compiled once however many entries and repeats play it, and
+// the entries place those passes in the song. The audio thread walks them with a
+// SongCursor instead of re-deriving steps per lane.
+struct ChainEntry
+{
+    int pattern;  // bank index, 0-based
+    int repeats;
+};
+
+using SongChain = std::vector<ChainEntry>;
+
+struct SongTimeline
+{
+    static constexpr int ticksPerQuarter = StepSequencer::ticksPerQuarter;
+
+    struct Event
+    {
+        double tick;                // from the pass start, microtiming and ratchet spacing included
+        int lane;
+        float velocity;
+        int lockIndex;              // into locks, or -1 when the step has none
+        float swingTicks;           // delay at full swing: half a step on odd steps
+        int groovePosition;         // the step's entry in a GrooveTable
+    };
+
+    // A lane's loop within a pass
+    struct LaneLoop
+    {
+        int steps;
+        int stepTicks;
+        int loopTicks;
+    };
+
+    // One bank pattern played once. Microtiming and ratchets can move hits before the
+    // pass starts or past its end, into the neighbouring passes.
+    struct Pass
+    {
+        std::vector<Event> events;      // sorted by tick, then lane
+        std::vector<LaneLoop> loops;    // one per lane
+        int lengthTicks { 0 };
+    };
+
+    struct Entry
+    {
+        double startTick;
+        int pass;                       // into passes
+        int repeats;
+    };
+
+    std::vector<Pass> passes;           // one per bank pattern the chain plays
+    std::vector<Entry> entries;         // in song order
+    std::vector<StepLocks> locks;       // each pass's records once, shared by its repeats
+    int numLanes { 0 };
+    int barTicks { StepSequencer::ticksPerBar };   // the host bar compiled for
+    double lengthTicks { 0.0 };         // the song loops after this
+    float maxSwingTicks { 0.0f };       // the largest swingTicks of any event
+    double maxEarlyTicks { 0.0 };       // furthest any hit lands before its pass starts
+    double maxLateTicks { 0.0 };        // furthest any hit lands after its pass ends
+
+    // Rebuilds the timeline from the lanes' banks for bars of hostBarTicks, the host's
+    // meter. Lanes loop within a pass as in pattern mode: one that fills n whole 4/4
+    // bars restarts every n host bars, dropping the steps a shorter bar has no room
+    // for, and any other lane loops at its own length. A pass lasts the longest lane loop,
+    // rounded up to whole bars. Ratchets are expanded into their hits here. The cost
+    // follows the distinct patterns the chain plays, not its entries or repeats.
+    // Allocates, so never call it on the audio thread.
+    void compile(const SongChain& chain, StepSequencer* const* lanes, int laneCount,
+                 int hostBarTicks = StepSequencer::ticksPerBar)
+    {
+        passes.clear();
+        entries.clear();
+        locks.clear();
+        numLanes = laneCount;
+        barTicks = juce::jmax(1, hostBarTicks);
+        maxSwingTicks = 0.0f;
+        maxEarlyTicks = maxLateTicks = 0.0;
+
+        std::array<int, (size_t) StepSequencer::numPatterns> passForPattern;
+        passForPattern.fill(-1);
+        double tick = 0.0;
+        for (const auto& entry : chain)
+        {
+            auto& pass = passForPattern[(size_t) entry.pattern];
+            if (pass < 0)
+            {
+                pass = (int) passes.size();
+                passes.push_back(compilePass(entry.pattern, lanes));
+            }
+            entries.push_back({ tick, pass, entry.repeats });
+            tick += (double) passes[(size_t) pass].lengthTicks * entry.repeats;
+        }
+        lengthTicks = tick;
+    }
+
+    // Step of a lane's pattern playing at tick, or -1 for an empty song
+    int getStepAt(double tick, int lane) const
+    {
+        if (lengthTicks <= 0.0 || lane < 0 || lane >= numLanes)
+            return -1;
+        const double songTick = std::fmod(juce::jmax(0.0, tick), lengthTicks);
+        const auto next = std::upper_bound(entries.begin(), entries.end(), songTick,
+                                           [](double t, const Entry& e) { return t < e.startTick; });
+        const auto& entry = *(next - (next != entries.begin() ? 1 : 0));
+        const auto& pass = passes[(size_t) entry.pass];
+        const auto& loop = pass.loops[(size_t) lane];
+        const double passTick = std::fmod(songTick - entry.startTick, (double) pass.lengthTicks);
+        return juce::jmin(loop.steps - 1, (int) (std::fmod(passTick, (double) loop.loopTicks) / loop.stepTicks));
+    }
+
+    // "1x4 2 3x2": bank pattern numbers from 1, each optionally repeated
+    static SongChain parseChain(const juce::String& text)
+    {
+        SongChain chain;
+        for (const auto& token : juce::StringArray::fromTokens(text.toLowerCase(), " ,", ""))
+        {
+            const int pattern = token.upToFirstOccurrenceOf("x", false, false).getIntValue() - 1;
+            const int repeats = token.containsChar('x') ? token.fromFirstOccurrenceOf("x", false, false).getIntValue() : 1;
+            if (pattern >= 0 && pattern < StepSequencer::numPatterns && repeats > 0)
+                chain.push_back({ pattern, juce::jmin(repeats, 999) });
+        }
+        return chain;
+    }
+
+    static juce::String chainToString(const SongChain& chain)
+    {
+        juce::StringArray tokens;
+        for (const auto& entry : chain)
+            tokens.add(juce::String(entry.pattern + 1) + (entry.repeats > 1 ? "x" + juce::String(entry.repeats) : juce::String()));
+        return tokens.joinIntoString(" ");
+    }
+
+private:
+    Pass compilePass(int patternIndex, StepSequencer* const* lanes)
+    {
+        Pass pass;
+        int passTicks = 1;
+        for (int lane = 0; lane < numLanes; ++lane)
+        {
+            const auto& pattern = lanes[lane]->getPattern(patternIndex);
+            const int stepTicks = StepSequencer::getDivisionTicks(pattern.division);
+            const int cycleTicks = pattern.steps * stepTicks;
+            const int bars = cycleTicks % StepSequencer::ticksPerBar == 0 ? cycleTicks / StepSequencer::ticksPerBar : 0;
+            pass.loops.push_back({ pattern.steps, stepTicks, bars > 0 ? bars * barTicks : cycleTicks });
+            passTicks = juce::jmax(passTicks, pass.loops.back().loopTicks);
+        }
+        passTicks = (passTicks + barTicks - 1) / barTicks * barTicks;
+        pass.lengthTicks = passTicks;
+
+        for (int lane = 0; lane < numLanes; ++lane)
+        {
+            const auto& pattern = lanes[lane]->getPattern(patternIndex);
+            const auto& loop = pass.loops[(size_t) lane];
+            const int stepTicks = loop.stepTicks;
+            maxSwingTicks = juce::jmax(maxSwingTicks, stepTicks * 0.5f);
+
+            const int lockBase = (int) locks.size();
+            locks.insert(locks.end(), pattern.locks.begin(), pattern.locks.begin() + StepSequencer::getNumLocks(pattern));
+
+            for (int loopStart = 0; loopStart < passTicks; loopStart += loop.loopTicks)
+            {
+                for (int w = 0; w < StepSequencer::numWords; ++w)
+                {
+                    for (auto mask = pattern.on[(size_t) w]; mask != 0; mask &= mask - 1)
+                    {
+                        const int k = w * 64 + BitOps::countTrailingZeros(mask);
+                        const int stepTick = loopStart + k * stepTicks;
+                        if (k * stepTicks >= loop.loopTicks || stepTick >= passTicks)
+                            break;
+                        const bool accent = ((pattern.accent[(size_t) w] >> (k & 63)) & 1) != 0;
+                        const bool locked = ((pattern.locked[(size_t) w] >> (k & 63)) & 1) != 0;
+                        const int lockIndex = locked ? lockBase + StepSequencer::getLockSlot(pattern, k) : -1;
+                        const float swingTicks = (k % 2) == 1 ? stepTicks * 0.5f : 0.0f;
+                        const int groovePosition = GrooveTable::getPosition(k * stepTicks);
+                        const double hitTick = stepTick + pattern.microTiming[(size_t) k] * (double) stepTicks / StepSequencer::microStepsPerStep;
+                        const int hits = pattern.ratchets[(size_t) k] + 1;
+                        for (int hit = 0; hit < hits; ++hit)
+                        {
+                            const float velocity = StepSequencer::getRatchetVelocity(accent ? 1.0f : 0.8f, pattern.ramps[(size_t) k], hit, hits);
+                            pass.events.push_back({ hitTick + hit * (double) stepTicks / hits, lane, velocity, lockIndex, swingTicks, groovePosition });
+                        }
+                    }
+                }
+            }
+        }
+
+        std::sort(pass.events.begin(), pass.events.end(), [](const Event& a, const Event& b)
+        {
+            return a.tick != b.tick ? a.tick < b.tick : a.lane < b.lane;
+        });
+        if (! pass.events.empty())
+        {
+            maxEarlyTicks = juce::jmax(maxEarlyTicks, -pass.events.front().tick);
+            maxLateTicks = juce::jmax(maxLateTicks, pass.events.back().tick - passTicks);
+        }
+        return pass;
+    }
+};
+
+// Audio thread: finds the timeline's hits for each block. The song starts at PPQ 0
+// and loops. A block looks up the entries and repeats it overlaps and searches only
+// their passes' hits, so it costs its own hits and a few binary searches, however
+// long the song. Hits moved past either end of the song land at the other.
+// Grooves apply as in pattern mode, through a copy of the groove's table that the
+// cursor rescales only when the groove or its strength change.
+class SongCursor
+{
+public:
+    template <size_t NumLanes>
+    void computeTriggers(const SongTimeline& timeline,
+                         const juce::AudioPlayHead::CurrentPositionInfo& pos,
+                         double sampleRate,
+                         int numSamples,
+                         float swingAmount,
+                         const GrooveTable& groove,
+                         float grooveStrength,
+                         std::array<TriggerQueue, NumLanes>& out)
+    {
+        for (auto& queue : out)
+            queue.clear();
+        if (!pos.isPlaying || pos.bpm <= 0.0 || timeline.lengthTicks <= 0.0)
+            return;
+
+        const float strength = juce::jlimit(0.0f, 1.0f, grooveStrength);
+        if (groove.id != scaledGroove.id || strength != scaledStrength)
+        {
+            scaledGroove.setScaled(groove, strength);
+            scaledStrength = strength;
+        }
+
+        const double ticksPerSample = SongTimeline::ticksPerQuarter * pos.bpm / (60.0 * sampleRate);
+        const double swing = juce::jlimit(0.0, 1.0, (double) swingAmount);
+        const double startTick = pos.ppqPosition * SongTimeline::ticksPerQuarter;
+        const double endTick = startTick + numSamples * ticksPerSample;
+        const double length = timeline.lengthTicks;
+
+        // Swing and a late groove can sound a hit after its own tick and an early groove
+        // before it, so the search looks back and ahead by those, plus a sample for the
+        // rounding in the offset test below
+        const double fromTick = startTick - (swing * timeline.maxSwingTicks + scaledGroove.maxLateTicks + ticksPerSample);
+        const double toTick = endTick + scaledGroove.maxEarlyTicks + ticksPerSample;
+
+        // A pass's hits reach from maxEarlyTicks before its start to maxLateTicks after its end
+        const double early = timeline.maxEarlyTicks, late = timeline.maxLateTicks;
+        const auto& entries = timeline.entries;
+        for (double loopStart = std::floor((fromTick - late) / length) * length; loopStart <= toTick + early; loopStart += length)
+        {
+            const double from = fromTick - loopStart, to = toTick - loopStart;
+            auto entry = std::upper_bound(entries.begin(), entries.end(), from - late,
+                                          [](double t, const SongTimeline::Entry& e) { return t < e.startTick; });
+            if (entry != entries.begin())
+                --entry;
+
+            for (; entry != entries.end() && entry->startTick - early <= to; ++entry)
+            {
+                const auto& pass = timeline.passes[(size_t) entry->pass];
+                const double passTicks = pass.lengthTicks;
+                const int firstRepeat = juce::jmax(0, (int) std::floor((from - late - entry->startTick) / passTicks));
+                const int lastRepeat = juce::jmin(entry->repeats - 1, (int) std::floor((to + early - entry->startTick) / passTicks));
+                for (int repeat = firstRepeat; repeat <= lastRepeat; ++repeat)
+                {
+                    const double passStart = loopStart + entry->startTick + repeat * passTicks;
+                    addHits(timeline, pass, passStart, fromTick, toTick, startTick, ticksPerSample, swing, numSamples, out);
+                }
+            }
+        }
+    }
+
+private:
+    template <size_t NumLanes>
+    void addHits(const SongTimeline& timeline, const SongTimeline::Pass& pass, double passStart,
+                 double fromTick, double toTick, double startTick, double ticksPerSample, double swing,
+                 int numSamples, std::array<TriggerQueue, NumLanes>& out) const
+    {
+        const auto& events = pass.events;
+        auto e = std::partition_point(events.begin(), events.end(),
+                                      [t = fromTick - passStart](const SongTimeline::Event& ev) { return ev.tick < t; });
+        for (; e != events.end() && e->tick <= toTick - passStart; ++e)
+        {
+            const auto groovePosition = (size_t) e->groovePosition;
+            const double tick = passStart + e->tick + swing * e->swingTicks + scaledGroove.offsetTicks[groovePosition];
+            const int offset = (int) std::ceil((tick - startTick) / ticksPerSample - 1.0e-6);
+            if (offset >= 0 && offset < numSamples && (size_t) e->lane < NumLanes)
+            {
+                StepTrigger trigger { offset, juce::jmin(1.0f, e->velocity * scaledGroove.velocityScale[groovePosition]) };
+                if (e->lockIndex >= 0)
+                    trigger.locks = timeline.locks[(size_t) e->lockIndex];
+                out[(size_t) e->lane].add(trigger);
+            }
+        }
+    }
+
+    GrooveTable scaledGroove;
+    float scaledStrength { 0.0f };
+};
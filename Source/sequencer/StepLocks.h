@@ -0,0 +1,34 @@
+#pragma once
+#include <JuceHeader.h>
+
+// Per-step overrides of a lane's parameters ("parameter locks"). A step carries a
+// value for each parameter whose bit is set in mask; the other parameters keep
+// following the lane.
+struct StepLocks
+{
+    enum Index { Pitch, Decay, Tone, Drive, NumParams };  // LaneParameters order
+
+    juce::uint8 mask { 0 };
+    std::array<float, NumParams> values {};
+
+    bool has(Index i) const { return (mask & (1u << i)) != 0; }
+
+    void set(Index i, float value)
+    {
+        mask = (juce::uint8) (mask | (1u << i));
+        values[(size_t) i] = value;
+    }
+
+    void clear(Index i) { mask = (juce::uint8) (mask & ~(1u << i)); }
+
+    // Recomputes only the locked parts of a voice Coeffs struct, so a step that locks
+    // one parameter costs one setter on top of the plain trigger
+    template <typename Coeffs>
+    void apply(Coeffs& c, double sampleRate) const
+    {
+        if (mask & (1u << Pitch)) c.setPitch(values[Pitch], sampleRate);
+        if (mask & (1u << Decay)) c.setDecay(values[Decay], sampleRate);
+        if (mask & (1u << Tone))  c.setTone(values[Tone], sampleRate);
+        if (mask & (1u << Drive)) c.setDrive(values[Drive], sampleRate);
+    }
+};
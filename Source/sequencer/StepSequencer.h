@@ -1,147 +1,587 @@
 #pragma once
 #include <JuceHeader.h>
+#include "TriggerQueue.h"
+#include "StepLocks.h"
+#include "GrooveTemplate.h"
+#include "../utils/BitOps.h"
+#include "../utils/SnapshotBuffer.h"
 
+// One lane's pattern as on/accent bitmasks, one bit per step. Every pattern has its
+// own length and step division. A pattern that fills whole 4/4 bars at its division
+// (16 steps of 1/16, 8 of 1/8, 64 of 1/32...) is tied to the bar line and restarts
+// every that many bars. Any other length loops freely from the start of the song, so
+// a 3-step lane drifts against a 16-step one (polymeter).
+//
+// Each lane keeps a bank of numPatterns patterns. The step setters and getters work
+// on the selected one. Pattern mode plays the bank slot computeTriggers() is given,
+// so lanes handed the same slot on the same block switch together; song mode plays
+// the bank through a SongTimeline compiled from every pattern.
+//
+// A step that is on can play as a ratchet of up to maxRatchets evenly spaced hits,
+// with a velocity ramp across them, and can be moved off the grid by a microtiming
+// offset of up to 23/24 of a step either way. Every hit is placed on its own sample.
+//
+// A groove (see GrooveTemplate) moves and weights steps by where they fall in the
+// pattern. Each lane scales the groove's table into its own per-step table, rebuilt
+// only when the groove, its strength or the pattern's timing change.
+//
+// A step that is on may also lock some of the lane parameters (see StepLocks). The
+// locks are stored sparsely: a bitmask of locked steps and a fixed array of records
+// packed in step order, so a pattern with few locks visits few records and a fully
+// locked one still fits without allocating.
+//
+// The setters and getters belong to the message thread, which edits a private copy
+// of the bank and publishes a complete snapshot of each pattern it changed after
+// every edit (or once per applyEdits() batch). computeTriggers() picks up the newest
+// snapshot of its slot on the audio thread without waiting or allocating, so a block
+// never sees a half-made edit.
 class StepSequencer
 {
 public:
-    void setStepsMode(bool is32)
+    static constexpr int maxSteps = 128;
+    static constexpr int stepsPerBar = 16;
+    static constexpr int numPatterns = 16;
+    static constexpr int numWords = maxSteps / 64;
+    static_assert(numPatterns <= 32, "unpublished bank slots are tracked in a 32-bit mask");
+
+    using Bits = std::array<juce::uint64, (size_t) numWords>;
+
+    // Step lengths a pattern can run at
+    enum Division { Quarter, Eighth, EighthTriplet, Sixteenth, SixteenthTriplet, ThirtySecond, NumDivisions };
+
+    static constexpr int ticksPerQuarter = 960;
+    static constexpr int ticksPerBar = 4 * ticksPerQuarter;  // 4/4, as 16 steps of 1/16 fill
+
+    static int getDivisionTicks(int division)
     {
-        steps = is32 ? 32 : 16;
-        if ((int)on.size() != steps)
-        {
-            on.assign(steps, false);
-            accent.assign(steps, false);
-            setDefaultPattern();
-        }
+        static constexpr int ticks[] = { 960, 480, 320, 240, 160, 120 };
+        return ticks[juce::jlimit(0, (int) NumDivisions - 1, division)];
+    }
+
+    static constexpr int maxRatchets = 8;
+    static constexpr int microStepsPerStep = 24;
+    static constexpr int maxMicroTiming = microStepsPerStep - 1;
+
+    static_assert(ticksPerBar == GrooveTemplate::slotsPerBar * GrooveTable::ticksPerSlot, "grooves are laid out in 1/16 slots");
+    static_assert(ticksPerQuarter / 6 % GrooveTable::resolutionTicks == 0, "every division starts steps on groove positions");
+
+    static const char* getDivisionName(int division)
+    {
+        static constexpr const char* names[] = { "1/4", "1/8", "1/8T", "1/16", "1/16T", "1/32" };
+        return names[juce::jlimit(0, (int) NumDivisions - 1, division)];
+    }
+
+    // Bit i of word i / 64 is step i; bits at or beyond steps are always clear and
+    // only steps that are on are locked. The locks of step i are locks[n], where n is
+    // the number of locked steps before i; records from the lock count on are empty.
+    // The per-step ratchet and microtiming bytes are zero on steps that are off.
+    struct Pattern
+    {
+        Bits on {}, accent {}, locked {};
+        int steps { 16 };
+        int division { Sixteenth };
+        std::array<StepLocks, (size_t) maxSteps> locks {};
+        std::array<juce::uint8, (size_t) maxSteps> ratchets {};   // hits after the first
+        std::array<juce::int8, (size_t) maxSteps> ramps {};       // ratchet velocity ramp, percent
+        std::array<juce::int8, (size_t) maxSteps> microTiming {}; // in 1/24 of a step
+    };
+
+    // Message thread: called after every published edit, e.g. to recompile the song
+    std::function<void()> onPatternChanged;
+
+    // Picks the pattern the setters and getters edit; what plays is up to the caller
+    // of computeTriggers()
+    void selectPattern(int index) { selected = juce::jlimit(0, numPatterns - 1, index); }
+    int getSelectedPattern() const { return selected; }
+
+    const Pattern& getPattern(int index) const { return bank[(size_t) index]; }
+
+    // Replaces a bank pattern, dropping any steps beyond its length
+    void setPattern(int index, const Pattern& pattern)
+    {
+        auto& dest = bank[(size_t) index];
+        dest = pattern;
+        dest.steps = juce::jlimit(1, maxSteps, dest.steps);
+        dest.division = juce::jlimit(0, (int) NumDivisions - 1, dest.division);
+        clearStepsFrom(dest, dest.steps);
+        publish(index);
     }
 
+    // Bits below the new length are kept and those above cleared, so shortening and
+    // lengthening again never brings back old steps. Never allocates.
+    void setNumSteps(int numSteps)
+    {
+        auto& edit = edited();
+        edit.steps = juce::jlimit(1, maxSteps, numSteps);
+        clearStepsFrom(edit, edit.steps);
+        publish();
+    }
+
+    void setDivision(int division)
+    {
+        edited().division = juce::jlimit(0, (int) NumDivisions - 1, division);
+        publish();
+    }
+    int getDivision() const { return edited().division; }
+
     void setDefaultPattern()
     {
-        // Start with all steps off and no accents
-        std::fill(on.begin(), on.end(), false);
-        std::fill(accent.begin(), accent.end(), false);
+        // Start with all steps off and no accents, keeping the length and division
+        auto& edit = edited();
+        Pattern empty;
+        empty.steps = edit.steps;
+        empty.division = edit.division;
+        edit = empty;
+        publish();
     }
 
     void setStepOn(int index, bool enabled)
     {
-        if (index >= 0 && index < (int) on.size()) on[(size_t) index] = enabled;
+        if (index >= 0 && index < edited().steps)
+        {
+            setBit(edited().on, index, enabled);
+            if (! enabled)
+                clearStep(edited(), index);
+            publish();
+        }
     }
     void setAccent(int index, bool enabled)
     {
-        if (index >= 0 && index < (int) accent.size()) accent[(size_t) index] = enabled;
+        if (index >= 0 && index < edited().steps) { setBit(edited().accent, index, enabled); publish(); }
     }
     bool getStepOn(int index) const
     {
-        return (index >= 0 && index < (int) on.size()) ? on[(size_t) index] : false;
+        return index >= 0 && index < edited().steps && getBit(edited().on, index);
     }
     bool getAccent(int index) const
     {
-        return (index >= 0 && index < (int) accent.size()) ? accent[(size_t) index] : false;
+        return index >= 0 && index < edited().steps && getBit(edited().accent, index);
     }
-    int getNumSteps() const { return steps; }
+    int getNumSteps() const { return edited().steps; }
+
+    // Ratchets and microtiming belong to a step that is on, like locks. A ratchet
+    // plays count hits (1 to maxRatchets) spread evenly over the step. A positive
+    // ramp (up to 1) rises to the step's velocity over them, a negative one falls
+    // from it. Microtiming moves the step by a signed number of 1/24 steps.
+    void setRatchet(int index, int count)
+    {
+        if (! getStepOn(index))
+            return;
+        edited().ratchets[(size_t) index] = (juce::uint8) (juce::jlimit(1, maxRatchets, count) - 1);
+        publish();
+    }
+    int getRatchet(int index) const
+    {
+        return index >= 0 && index < edited().steps ? edited().ratchets[(size_t) index] + 1 : 1;
+    }
+    void setRatchetRamp(int index, float ramp)
+    {
+        if (! getStepOn(index))
+            return;
+        edited().ramps[(size_t) index] = (juce::int8) juce::roundToInt(juce::jlimit(-1.0f, 1.0f, ramp) * 100.0f);
+        publish();
+    }
+    float getRatchetRamp(int index) const
+    {
+        return index >= 0 && index < edited().steps ? edited().ramps[(size_t) index] * 0.01f : 0.0f;
+    }
+    void setMicroTiming(int index, int microSteps)
+    {
+        if (! getStepOn(index))
+            return;
+        edited().microTiming[(size_t) index] = (juce::int8) juce::jlimit(-maxMicroTiming, maxMicroTiming, microSteps);
+        publish();
+    }
+    int getMicroTiming(int index) const
+    {
+        return index >= 0 && index < edited().steps ? edited().microTiming[(size_t) index] : 0;
+    }
+
+    // Velocity of hit `hit` of a ratchet of `hits`, for a ramp in percent. A full ramp
+    // starts (or ends) at 1/hits of the velocity rather than at 0, so every hit it
+    // fires sounds, as a silent one would still steal a voice and choke its group.
+    static float getRatchetVelocity(float velocity, int rampPercent, int hit, int hits)
+    {
+        if (rampPercent == 0 || hits < 2)
+            return velocity;
+        const float position = (float) hit / (float) (hits - 1);
+        const float ramp = rampPercent * 0.01f * (float) (hits - 1) / (float) hits;
+        return velocity * (ramp > 0.0f ? 1.0f - ramp * (1.0f - position) : 1.0f + ramp * position);
+    }
+
+    // Locks belong to a step that is on; setLock() on a step that is off does nothing
+    void setLock(int index, StepLocks::Index param, float value)
+    {
+        if (! getStepOn(index))
+            return;
+        auto locks = getStepLocks(edited(), index);
+        locks.set(param, value);
+        setStepLocks(edited(), index, locks);
+        publish();
+    }
+    void clearLock(int index, StepLocks::Index param)
+    {
+        if (index < 0 || index >= edited().steps || ! getBit(edited().locked, index))
+            return;
+        auto locks = getStepLocks(edited(), index);
+        locks.clear(param);
+        setStepLocks(edited(), index, locks);
+        publish();
+    }
+    StepLocks getLocks(int index) const
+    {
+        return index >= 0 && index < edited().steps ? getStepLocks(edited(), index) : StepLocks {};
+    }
+
+    // Lock records of a pattern by step; an empty mask removes the step's record
+    static StepLocks getStepLocks(const Pattern& pattern, int index)
+    {
+        return getBit(pattern.locked, index) ? pattern.locks[(size_t) getLockSlot(pattern, index)] : StepLocks {};
+    }
+
+    static void setStepLocks(Pattern& pattern, int index, const StepLocks& locks)
+    {
+        const bool had = getBit(pattern.locked, index);
+        if (! had && locks.mask == 0)
+            return;
+
+        const auto slot = pattern.locks.begin() + getLockSlot(pattern, index);
+        const auto used = pattern.locks.begin() + getNumLocks(pattern);
+        if (locks.mask == 0)
+        {
+            std::move(slot + 1, used, slot);
+            *(used - 1) = {};
+        }
+        else
+        {
+            if (! had)
+                std::move_backward(slot, used, used + 1);
+            *slot = locks;
+        }
+        setBit(pattern.locked, index, locks.mask != 0);
+    }
+
+    static int getNumLocks(const Pattern& pattern)
+    {
+        int count = 0;
+        for (auto word : pattern.locked)
+            count += juce::countNumberOfBits(word);
+        return count;
+    }
+
+    // Number of locked steps before index, i.e. where its record is or would go
+    static int getLockSlot(const Pattern& pattern, int index)
+    {
+        int slot = 0;
+        for (int w = 0; w < (index >> 6); ++w)
+            slot += juce::countNumberOfBits(pattern.locked[(size_t) w]);
+        const auto below = ((juce::uint64) 1 << (index & 63)) - 1;
+        return slot + juce::countNumberOfBits(pattern.locked[(size_t) (index >> 6)] & below);
+    }
+
+    // Runs several edits and publishes the result once, so the audio thread never
+    // plays a lane that is only partly cleared or pasted
+    template <typename Fn>
+    void applyEdits(Fn&& fn)
+    {
+        ++editDepth;
+        fn();
+        --editDepth;
+        publishChanged();
+    }
+
+    using Trigger = StepTrigger;
 
-    struct Trigger { int sampleOffset; float velocity; };
+    // Every hit of a fully ratcheted pattern twice over, as microtiming and ratchets
+    // let a block reach into the end of one cycle and the start of the next
+    static constexpr int maxTriggersPerBlock = 2 * maxSteps * maxRatchets;
 
+    // Audio thread. Plays the newest snapshot of bank slot pattern at its own length
+    // and division, with the groove at grooveStrength (0 to 1). The step positions come
+    // from the timing table, so a block only searches it for the steps whose hits can
+    // reach inside and places each of their hits on its sample.
     void computeTriggers(const juce::AudioPlayHead::CurrentPositionInfo& pos,
                          double sampleRate,
                          int numSamples,
-                         bool is32Mode,
+                         int pattern,
                          float swingAmount,
-                         juce::Array<Trigger>& out)
+                         const GrooveTable& groove,
+                         float grooveStrength,
+                         TriggerQueue& out)
     {
         out.clear();
+        const auto& live = snapshots[(size_t) juce::jlimit(0, numPatterns - 1, pattern)].read();
         if (!pos.isPlaying || pos.bpm <= 0.0)
             return;
 
-        setStepsMode(is32Mode);
+        updateTiming(live, swingAmount, getBarLengthPPQ(pos));
+        updateGroove(live, groove, juce::jlimit(0.0f, 1.0f, grooveStrength));
 
         const double samplesPerBeat = sampleRate * 60.0 / pos.bpm;
-        const double ppqPerStep = 0.25; // 1/16
-        const double sequenceLengthPPQ = steps * ppqPerStep;
-
         const double startPPQ = pos.ppqPosition;
         const double endPPQ   = startPPQ + (double)numSamples / samplesPerBeat;
 
-        const double barPPQ = getBarLengthPPQ(pos);
-        double anchorPPQ = pos.ppqPositionOfLastBarStart;
-        if (anchorPPQ <= 0.0)
-            anchorPPQ = std::floor(startPPQ / barPPQ) * barPPQ;
-
-        const double relStart = startPPQ - anchorPPQ;
-        const double relEnd   = endPPQ   - anchorPPQ;
-        int firstStep = (int) std::floor(relStart / ppqPerStep);
-        int lastStep  = (int) std::floor(relEnd   / ppqPerStep);
-        firstStep = juce::jlimit(0, steps - 1, firstStep);
-        lastStep  = juce::jlimit(0, steps - 1, lastStep);
-
-        for (int k = firstStep; k <= lastStep; ++k)
+        // How far a step's hits can land from its table position, plus a sample of
+        // slack for the rounding in the offset test, which has the last word
+        const double slackPPQ = 1.0 / samplesPerBeat;
+        const double earlyPPQ = maxMicroTiming * timing.microPPQ + timing.grooveEarlyPPQ + slackPPQ;
+        const double latePPQ  = maxMicroTiming * timing.microPPQ + timing.stepLengthPPQ + timing.grooveLatePPQ + slackPPQ;
+
+        const double* times = timing.stepPPQ.data();
+        const double* timesEnd = times + timing.playableSteps;
+
+        // Starting as many cycles early as the late hits reach picks up those of earlier
+        // cycles; a short pattern can loop several times within a long block
+        const double firstAnchorPPQ = getCycleStartPPQ(pos) - std::ceil(latePPQ / timing.cyclePPQ) * timing.cyclePPQ;
+        for (double anchorPPQ = firstAnchorPPQ; anchorPPQ <= endPPQ + earlyPPQ; anchorPPQ += timing.cyclePPQ)
+        {
+            const int firstStep = (int) (std::lower_bound(times, timesEnd, startPPQ - anchorPPQ - latePPQ) - times);
+            const int lastStep  = (int) (std::upper_bound(times, timesEnd, endPPQ - anchorPPQ + earlyPPQ) - times) - 1;
+            if (firstStep > lastStep)
+                continue;
+
+            // Only set bits are visited, so the cost follows the hits, not the steps
+            for (int w = firstStep / 64; w <= lastStep / 64; ++w)
+            {
+                for (auto mask = live.on[(size_t) w] & wordMask(w, firstStep, lastStep); mask != 0; mask &= mask - 1)
+                {
+                    const int k = w * 64 + BitOps::countTrailingZeros(mask);
+                    const double stepPPQ = anchorPPQ + times[k] + timing.grooveOffsetPPQ[(size_t) k] + live.microTiming[(size_t) k] * timing.microPPQ;
+                    const int hits = live.ratchets[(size_t) k] + 1;
+                    const double spacingPPQ = timing.ratchetPPQ[(size_t) hits];
+
+                    const float velocity = getBit(live.accent, k) ? 1.0f : 0.8f;
+                    const float grooveVelocity = timing.grooveVelocity[(size_t) k];
+                    StepTrigger trigger { 0, velocity };
+                    if (getBit(live.locked, k))
+                        trigger.locks = live.locks[(size_t) getLockSlot(live, k)];
+
+                    for (int hit = 0; hit < hits; ++hit)
+                    {
+                        trigger.sampleOffset = sampleOffsetFor(stepPPQ + hit * spacingPPQ - startPPQ, samplesPerBeat);
+                        if (trigger.sampleOffset >= 0 && trigger.sampleOffset < numSamples)
+                        {
+                            trigger.velocity = juce::jmin(1.0f, getRatchetVelocity(velocity, live.ramps[(size_t) k], hit, hits) * grooveVelocity);
+                            out.add(trigger);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // Length of a bar in the host's time signature, 4/4 when it gives none
+    static double getBarLengthPPQ(const juce::AudioPlayHead::CurrentPositionInfo& pos)
+    {
+        int num = pos.timeSigNumerator > 0 ? pos.timeSigNumerator : 4;
+        int den = pos.timeSigDenominator > 0 ? pos.timeSigDenominator : 4;
+        return (double) num * (4.0 / (double) den);
+    }
+
+    // Audio thread, after computeTriggers() for the same block
+    int computeCurrentStepIndex(const juce::AudioPlayHead::CurrentPositionInfo& pos) const
+    {
+        if (!pos.isPlaying || pos.bpm <= 0.0 || timing.steps <= 0) return -1;
+        const double rel = juce::jmax(0.0, pos.ppqPosition - getCycleStartPPQ(pos));
+        return juce::jmin(timing.steps - 1, (int) std::floor(rel / timing.stepLengthPPQ));
+    }
+
+private:
+    // Where the live pattern's steps fall within one cycle, swing included. Rebuilt
+    // on the audio thread only when the length, division, swing or bar length change;
+    // it is a fixed array, so that never allocates.
+    struct StepTiming
+    {
+        std::array<double, (size_t) maxSteps> stepPPQ {};  // ascending, as swing is under a step
+        std::array<double, (size_t) maxRatchets + 1> ratchetPPQ {};  // hit spacing by hit count
+        double stepLengthPPQ { 0.25 };
+        double microPPQ { 0.25 / microStepsPerStep };
+        double cyclePPQ { 4.0 };
+        int playableSteps { 0 };   // steps that start within the cycle
+        int barsPerCycle { 0 };    // 0 when the pattern runs free of the bar line
+
+        // The groove at the lane's steps, scaled by its strength
+        std::array<double, (size_t) maxSteps> grooveOffsetPPQ {};
+        std::array<float, (size_t) maxSteps> grooveVelocity {};
+        double grooveEarlyPPQ { 0.0 }, grooveLatePPQ { 0.0 };
+
+        // The settings the tables were built for
+        int steps { -1 }, division { -1 };
+        float swing { -1.0f };
+        double barPPQ { -1.0 };
+        int grooveId { -1 }, grooveDivision { -1 };
+        float grooveStrength { -1.0f };
+    };
+
+    void updateTiming(const Pattern& pattern, float swingAmount, double barPPQ)
+    {
+        if (pattern.steps == timing.steps && pattern.division == timing.division
+            && swingAmount == timing.swing && barPPQ == timing.barPPQ)
+            return;
+
+        timing.steps = pattern.steps;
+        timing.division = pattern.division;
+        timing.swing = swingAmount;
+        timing.barPPQ = barPPQ;
+
+        const int stepTicks = getDivisionTicks(pattern.division);
+        timing.stepLengthPPQ = (double) stepTicks / ticksPerQuarter;
+        timing.microPPQ = timing.stepLengthPPQ / microStepsPerStep;
+        for (int hits = 1; hits <= maxRatchets; ++hits)
+            timing.ratchetPPQ[(size_t) hits] = timing.stepLengthPPQ / hits;
+        const double swingPPQ = juce::jlimit(0.0, 1.0, (double) swingAmount) * timing.stepLengthPPQ * 0.5;
+        for (int k = 0; k < pattern.steps; ++k)
+            timing.stepPPQ[(size_t) k] = (double) k * timing.stepLengthPPQ + ((k % 2) == 1 ? swingPPQ : 0.0);
+
+        const int cycleTicks = pattern.steps * stepTicks;
+        timing.barsPerCycle = cycleTicks % ticksPerBar == 0 ? cycleTicks / ticksPerBar : 0;
+        timing.cyclePPQ = timing.barsPerCycle > 0 ? timing.barsPerCycle * barPPQ : (double) cycleTicks / ticksPerQuarter;
+
+        // Steps past the end of a cycle (a bar shorter than 4/4) never play
+        timing.playableSteps = juce::jmin(pattern.steps, (int) std::ceil(timing.cyclePPQ / timing.stepLengthPPQ - 1.0e-9));
+    }
+
+    void updateGroove(const Pattern& pattern, const GrooveTable& groove, float strength)
+    {
+        if (groove.id == timing.grooveId && strength == timing.grooveStrength && pattern.division == timing.grooveDivision)
+            return;
+
+        timing.grooveId = groove.id;
+        timing.grooveStrength = strength;
+        timing.grooveDivision = pattern.division;
+
+        const int stepTicks = getDivisionTicks(pattern.division);
+        for (int k = 0; k < maxSteps; ++k)
         {
-            if (!on[k]) continue;
+            const auto position = (size_t) GrooveTable::getPosition(k * stepTicks);
+            timing.grooveOffsetPPQ[(size_t) k] = (double) strength * groove.offsetTicks[position] / ticksPerQuarter;
+            timing.grooveVelocity[(size_t) k] = 1.0f + strength * (groove.velocityScale[position] - 1.0f);
+        }
+        timing.grooveEarlyPPQ = (double) strength * groove.maxEarlyTicks / ticksPerQuarter;
+        timing.grooveLatePPQ = (double) strength * groove.maxLateTicks / ticksPerQuarter;
+    }
 
-            double swingPPQ = 0.0;
-            if ((k % 2) == 1)
-                swingPPQ = juce::jlimit(0.0, 1.0, (double)swingAmount) * ppqPerStep * 0.5;
+    Pattern& edited() { return bank[(size_t) selected]; }
+    const Pattern& edited() const { return bank[(size_t) selected]; }
 
-            const double stepPPQ = anchorPPQ + (double)k * ppqPerStep + swingPPQ;
+    void publish() { publish(selected); }
 
-            if (stepPPQ >= startPPQ && stepPPQ < endPPQ)
+    void publish(int index)
+    {
+        changedPatterns |= 1u << index;
+        if (editDepth == 0)
+            publishChanged();
+    }
+
+    void publishChanged()
+    {
+        if (changedPatterns == 0)
+            return;
+        for (auto mask = changedPatterns; mask != 0; mask &= mask - 1)
+        {
+            const auto index = (size_t) BitOps::countTrailingZeros(mask);
+            snapshots[index].getWriteSlot() = bank[index];
+            snapshots[index].publish();
+        }
+        changedPatterns = 0;
+        if (onPatternChanged)
+            onPatternChanged();
+    }
+
+    // Drops everything a step carries besides its on bit
+    static void clearStep(Pattern& pattern, int index)
+    {
+        setStepLocks(pattern, index, {});
+        pattern.ratchets[(size_t) index] = 0;
+        pattern.ramps[(size_t) index] = 0;
+        pattern.microTiming[(size_t) index] = 0;
+    }
+
+    // Clears every step from steps on, and what steps that are off carry, keeping
+    // the remaining lock records packed
+    static void clearStepsFrom(Pattern& pattern, int steps)
+    {
+        int kept = 0, slot = 0;
+        for (int w = 0; w < numWords; ++w)
+        {
+            const auto keep = wordMask(w, 0, steps - 1);
+            pattern.on[(size_t) w] &= keep;
+            pattern.accent[(size_t) w] &= keep;
+            for (auto mask = pattern.locked[(size_t) w]; mask != 0; mask &= mask - 1, ++slot)
             {
-                const double offsetSamplesD = (stepPPQ - startPPQ) * samplesPerBeat;
-                int offsetSamples = (int)std::round(offsetSamplesD);
-                float vel = accent[k] ? 1.0f : 0.8f;
-                out.add({ juce::jlimit(0, numSamples - 1, offsetSamples), vel });
+                const auto bit = mask & (~mask + 1);
+                if ((pattern.on[(size_t) w] & bit) != 0)
+                    pattern.locks[(size_t) kept++] = pattern.locks[(size_t) slot];
+                else
+                    pattern.locked[(size_t) w] &= ~bit;
             }
         }
+        std::fill(pattern.locks.begin() + kept, pattern.locks.end(), StepLocks {});
 
-        if (relEnd >= sequenceLengthPPQ)
+        for (int k = 0; k < maxSteps; ++k)
         {
-            double nextAnchor = anchorPPQ + barPPQ;
-            const double relStart2 = startPPQ - nextAnchor;
-            const double relEnd2   = endPPQ   - nextAnchor;
-            int firstStep2 = juce::jlimit(0, steps - 1, (int) std::floor(relStart2 / ppqPerStep));
-            int lastStep2  = juce::jlimit(0, steps - 1, (int) std::floor(relEnd2   / ppqPerStep));
-            for (int k = firstStep2; k <= lastStep2; ++k)
+            if (! getBit(pattern.on, k))
             {
-                if (!on[k]) continue;
-                double swingPPQ = ((k % 2) == 1) ? juce::jlimit(0.0, 1.0, (double)swingAmount) * ppqPerStep * 0.5 : 0.0;
-                const double stepPPQ = nextAnchor + (double)k * ppqPerStep + swingPPQ;
-                if (stepPPQ >= startPPQ && stepPPQ < endPPQ)
-                {
-                    const double offsetSamplesD = (stepPPQ - startPPQ) * samplesPerBeat;
-                    int offsetSamples = (int)std::round(offsetSamplesD);
-                    float vel = accent[k] ? 1.0f : 0.8f;
-                    out.add({ juce::jlimit(0, numSamples - 1, offsetSamples), vel });
-                }
+                pattern.ratchets[(size_t) k] = 0;
+                pattern.ramps[(size_t) k] = 0;
+                pattern.microTiming[(size_t) k] = 0;
             }
         }
     }
 
-    int computeCurrentStepIndex(const juce::AudioPlayHead::CurrentPositionInfo& pos,
-                                bool is32Mode) const
+    static bool getBit(const Bits& bits, int index)
+    {
+        return ((bits[(size_t) (index >> 6)] >> (index & 63)) & 1) != 0;
+    }
+
+    static void setBit(Bits& bits, int index, bool enabled)
     {
-        if (!pos.isPlaying || pos.bpm <= 0.0) return -1;
-        int s = is32Mode ? 32 : 16;
-        const double ppqPerStep = 0.25;
+        const auto bit = (juce::uint64) 1 << (index & 63);
+        auto& word = bits[(size_t) (index >> 6)];
+        word = enabled ? (word | bit) : (word & ~bit);
+    }
+
+    // Bits of word w that fall within steps [first, last]; zero when none do
+    static juce::uint64 wordMask(int w, int first, int last)
+    {
+        const int lo = juce::jmax(0, first - w * 64);
+        const int hi = juce::jmin(63, last - w * 64);
+        if (lo > hi)
+            return 0;
+        return (~(juce::uint64) 0 << lo) & (~(juce::uint64) 0 >> (63 - hi));
+    }
+
+    // Start of the current cycle. A bar-locked pattern takes the last bar start and
+    // moves back to its first bar by counting bars from the start of the song; a free
+    // one counts whole cycles from the start of the song.
+    double getCycleStartPPQ(const juce::AudioPlayHead::CurrentPositionInfo& pos) const
+    {
+        if (timing.barsPerCycle == 0)
+            return std::floor(pos.ppqPosition / timing.cyclePPQ) * timing.cyclePPQ;
+
         const double barPPQ = getBarLengthPPQ(pos);
-        double anchorPPQ = pos.ppqPositionOfLastBarStart;
-        if (anchorPPQ <= 0.0) anchorPPQ = std::floor(pos.ppqPosition / barPPQ) * barPPQ;
-        double rel = pos.ppqPosition - anchorPPQ;
-        if (rel < 0.0) rel = 0.0;
-        int idx = (int) std::floor(std::fmod(rel, s * ppqPerStep) / ppqPerStep);
-        if (idx < 0) idx = 0;
-        if (idx >= s) idx = s - 1;
-        return idx;
+        double barStartPPQ = pos.ppqPositionOfLastBarStart;
+        if (barStartPPQ <= 0.0)
+            barStartPPQ = std::floor(pos.ppqPosition / barPPQ) * barPPQ;
+
+        const int bars = timing.barsPerCycle;
+        const auto barIndex = (juce::int64) std::llround(barStartPPQ / barPPQ);
+        const auto barInPattern = ((barIndex % bars) + bars) % bars;
+        return barStartPPQ - (double) barInPattern * barPPQ;
     }
 
-private:
-    static double getBarLengthPPQ(const juce::AudioPlayHead::CurrentPositionInfo& pos)
+    // A step fires on the first sample at or after its exact position. Deciding
+    // membership by that sample index (not by PPQ) assigns every step to exactly
+    // one block, whatever the host buffer size.
+    static int sampleOffsetFor(double relativePPQ, double samplesPerBeat)
     {
-        int num = pos.timeSigNumerator > 0 ? pos.timeSigNumerator : 4;
-        int den = pos.timeSigDenominator > 0 ? pos.timeSigDenominator : 4;
-        return (double) num * (4.0 / (double) den);
+        return (int) std::ceil(relativePPQ * samplesPerBeat - 1.0e-6);
     }
 
-    int steps { 16 };
-    std::vector<bool> on { std::vector<bool>(16, false) };
-    std::vector<bool> accent { std::vector<bool>(16, false) };
+    std::array<Pattern, (size_t) numPatterns> bank;  // message thread
+    int selected { 0 };
+    int editDepth { 0 };
+    juce::uint32 changedPatterns { 0 };             // bank slots not yet published
+    std::array<SnapshotBuffer<Pattern>, (size_t) numPatterns> snapshots;  // bank -> audio thread
+    StepTiming timing;                              // audio thread
 };
\ No newline at end of file
@@ -0,0 +1,46 @@
+#pragma once
+#include <JuceHeader.h>
+#include "StepLocks.h"
+
+struct StepTrigger
+{
+    int sampleOffset;
+    float velocity;
+    StepLocks locks {};  // copied from the step, so nothing points into the pattern
+};
+
+// Fixed-capacity list of one lane's triggers for the current block. Storage is
+// reserved in prepareToPlay, so the audio thread only writes into existing memory.
+class TriggerQueue
+{
+public:
+    void reserve(int capacity)
+    {
+        storage.resize((size_t) juce::jmax(1, capacity));
+        count = 0;
+    }
+
+    void clear() { count = 0; }
+
+    bool add(const StepTrigger& t)
+    {
+        if (count >= (int) storage.size())
+        {
+            jassertfalse; // capacity chosen in prepareToPlay is too small
+            return false;
+        }
+        storage[(size_t) count++] = t;
+        return true;
+    }
+
+    int size() const { return count; }
+    int capacity() const { return (int) storage.size(); }
+    const StepTrigger& operator[](int index) const { return storage[(size_t) index]; }
+
+    const StepTrigger* begin() const { return storage.data(); }
+    const StepTrigger* end() const   { return storage.data() + count; }
+
+private:
+    std::vector<StepTrigger> storage;
+    int count { 0 };
+};
@@ -116,9 +116,9 @@ public:
 
         int rows = lanes.size();
         if (rows == 0) return;
-        int steps = lanes[0].seq->getNumSteps();
+        int steps = getNumColumns();
         float rowGap = 6.0f;
-        float padGap = 4.0f;
+        float padGap = getPadGap(steps);
         float rowH = ((float)padArea.getHeight() - rowGap * (rows - 1)) / (float)rows;
         float padW = ((float)padArea.getWidth() - labelW - controlW) / (float)steps - padGap;
 
@@ -138,7 +138,7 @@ public:
             playCol = playCol.withAlpha(0.8f);
         }
 
-        // Beat numbers per row (1–4 or 1–8)
+        // Beat numbers per row (1–4 up to 1–32)
         int beats = steps / 4;
         g.setColour(juce::Colours::white.withAlpha(0.6f));
         g.setFont(juce::FontOptions(11.0f));
@@ -163,11 +163,26 @@ public:
             g.setFont(juce::FontOptions(12.0f));
             g.drawFittedText(lanes[r].label, juce::Rectangle<int>(padArea.getX(), (int)y, (int)labelW, (int)rowH), juce::Justification::centredLeft, 1);
 
+            // Lane length and division
+            const int laneSteps = lanes[r].seq->getNumSteps();
+            g.setColour(juce::Colours::white.withAlpha(0.6f));
+            g.setFont(juce::FontOptions(10.0f));
+            g.drawText(juce::String(laneSteps) + " x " + StepSequencer::getDivisionName(lanes[r].seq->getDivision()),
+                       juce::Rectangle<int>(padArea.getX(), (int)(y + rowH) - 12, (int)labelW - 8, 12), juce::Justification::centredRight);
+
             for (int i = 0; i < steps; ++i)
             {
                 float x = (float)padArea.getX() + labelW + i * (padW + padGap);
                 juce::Rectangle<float> rct{ x, y, padW, rowH };
 
+                // Columns past this lane's length only show the background
+                if (i >= laneSteps)
+                {
+                    g.setColour(baseB.withMultipliedAlpha(0.35f));
+                    g.fillRoundedRectangle(rct, 6.0f);
+                    continue;
+                }
+
                 // Alternating background every 4 steps (4/4 beat groups)
                 int group = (i / 4) % 2;
                 g.setColour(group == 0 ? baseA : baseB);
@@ -198,6 +213,30 @@ public:
                     g.fillRoundedRectangle(accRect, 2.0f);
                 }
 
+                // Ratchets (one tick per hit) and microtiming (a line off the pad centre)
+                if (on)
+                {
+                    const int hits = lanes[r].seq->getRatchet(i);
+                    g.setColour(juce::Colours::black.withAlpha(0.45f));
+                    for (int h = 1; h < hits; ++h)
+                        g.fillRect(rct.getX() + rct.getWidth() * (float) h / (float) hits, rct.getY() + 8.0f, 1.0f, 6.0f);
+
+                    const int micro = lanes[r].seq->getMicroTiming(i);
+                    if (micro != 0)
+                    {
+                        g.setColour(juce::Colours::white.withAlpha(0.7f));
+                        const float mx = rct.getCentreX() + rct.getWidth() * 0.5f * (float) micro / (float) StepSequencer::microStepsPerStep;
+                        g.fillRect(mx - 0.5f, rct.getBottom() - 14.0f, 1.5f, 6.0f);
+                    }
+                }
+
+                // Parameter locks (small dot at the bottom)
+                if (on && lanes[r].seq->getLocks(i).mask != 0)
+                {
+                    g.setColour(juce::Colours::white.withAlpha(0.8f));
+                    g.fillEllipse(rct.getCentreX() - 2.0f, rct.getBottom() - 8.0f, 4.0f, 4.0f);
+                }
+
                 // Current step highlight per lane
                 int cur = currentSteps.size() > r ? currentSteps[r] : -1;
                 if (i == cur)
@@ -206,8 +245,8 @@ public:
                     g.drawRoundedRectangle(rct.reduced(1.0f), 6.0f, 2.0f);
                 }
 
-                // Strong separator at bar boundary (step 0 and 16)
-                if (i == 0 || (steps == 32 && i == 16))
+                // Strong separator at each bar boundary
+                if (i % StepSequencer::stepsPerBar == 0)
                 {
                     g.setColour(juce::Colours::black.withAlpha(0.4f));
                     g.fillRect((int) (x - padGap * 0.5f), (int) y, 2, (int) rowH);
@@ -216,12 +255,78 @@ public:
         }
     }
 
-    void mouseDown(const juce::MouseEvent& e) override { toggleFromMouse(e); }
-    void mouseDrag(const juce::MouseEvent& e) override { toggleFromMouse(e); }
+    void mouseDown(const juce::MouseEvent& e) override
+    {
+        if (e.mods.isShiftDown() && (e.mods.isRightButtonDown() || e.mods.isAltDown()))
+            showDivisionMenu(e);
+        else if (e.mods.isCommandDown())
+            showLockMenu(e);
+        else
+            toggleFromMouse(e);
+    }
+    void mouseDrag(const juce::MouseEvent& e) override
+    {
+        if (! e.mods.isCommandDown())
+            toggleFromMouse(e);
+    }
+
+    // Over a step that is on, the wheel sets its ratchet hits, Shift+wheel nudges its
+    // microtiming and Ctrl/Cmd+wheel changes the ratchet's velocity ramp
+    void mouseWheelMove(const juce::MouseEvent& e, const juce::MouseWheelDetails& wheel) override
+    {
+        const auto [row, col] = getCellAt(e);
+        const float delta = wheel.deltaY != 0.0f ? wheel.deltaY : wheel.deltaX;
+        if (row < 0 || col < 0 || delta == 0.0f || ! lanes[row].seq->getStepOn(col))
+        {
+            Component::mouseWheelMove(e, wheel);
+            return;
+        }
+
+        auto& seq = *lanes[row].seq;
+        const int direction = (delta > 0.0f) != wheel.isReversed ? 1 : -1;
+        if (e.mods.isCommandDown())
+            seq.setRatchetRamp(col, seq.getRatchetRamp(col) + 0.25f * (float) direction);
+        else if (e.mods.isShiftDown())
+            seq.setMicroTiming(col, seq.getMicroTiming(col) + direction);
+        else
+            seq.setRatchet(col, seq.getRatchet(col) + direction);
+        repaint();
+    }
 
 private:
     struct Lane { StepSequencer* seq; juce::String label; };
 
+    // Multi-bar patterns tighten the gaps so 128 pads still fit the row
+    static float getPadGap(int steps) { return steps > 32 ? 1.0f : 4.0f; }
+
+    // One column per step of the longest lane
+    int getNumColumns() const
+    {
+        int steps = 1;
+        for (const auto& lane : lanes)
+            steps = juce::jmax(steps, lane.seq->getNumSteps());
+        return steps;
+    }
+
+    // Row and column under the mouse, or -1 for either when outside the pads
+    std::pair<int, int> getCellAt(const juce::MouseEvent& e) const
+    {
+        auto padArea = getLocalBounds().reduced(8);
+        int rows = lanes.size();
+        if (rows == 0) return { -1, -1 };
+        int steps = getNumColumns();
+        float rowGap = 6.0f;
+        float padGap = getPadGap(steps);
+        float rowH = ((float)padArea.getHeight() - rowGap * (rows - 1)) / (float)rows;
+        float padW = ((float)padArea.getWidth() - labelW) / (float)steps - padGap;
+
+        float localY = (float)e.position.getY() - (float)padArea.getY();
+        int row = (int) ((localY) / (rowH + rowGap));
+        float localX = (float)e.position.getX() - (float)padArea.getX() - labelW;
+        int col = (int) (localX / (padW + padGap));
+        return { (row < 0 || row >= rows) ? -1 : row, (localX < 0.0f || col >= steps) ? -1 : col };
+    }
+
     // Map pitch/decay parameter IDs per row
     std::pair<juce::String, juce::String> getPitchDecayParamIdsForRow(int row)
     {
@@ -284,50 +389,56 @@ private:
         juce::File initialDir = juce::File::getCurrentWorkingDirectory().getChildFile("LoFi Drums");
         if (! initialDir.exists()) initialDir = juce::File::getSpecialLocation(juce::File::userDocumentsDirectory);
         
-        auto chooser = std::make_shared<juce::FileChooser>("Choose a sample", initialDir, "*.wav;*.aiff;*.aif");
-        chooser->launchAsync(juce::FileBrowserComponent::openMode | juce::FileBrowserComponent::canSelectFiles,
+        // A folder loads as a multisample kit of velocity layers and round-robin variants
+        auto chooser = std::make_shared<juce::FileChooser>("Choose a sample or a kit folder", initialDir, "*.wav;*.aiff;*.aif");
+        chooser->launchAsync(juce::FileBrowserComponent::openMode | juce::FileBrowserComponent::canSelectFiles
+                                 | juce::FileBrowserComponent::canSelectDirectories,
             [this, lane, chooser](const juce::FileChooser& fc)
             {
                 const auto file = fc.getResult();
-                if (! file.existsAsFile())
+                if (! file.exists())
                     return;
 
-                const bool ok = processor.loadSampleForLane(lane, file);
-                if (! ok)
-                {
-                    juce::NativeMessageBox::showMessageBoxAsync(juce::AlertWindow::WarningIcon,
-                                                                "Sample load failed",
-                                                                "No se pudo cargar el archivo: " + file.getFileName());
-                }
-                else
-                {
-                    // Simple feedback so the user knows which lane has a sample loaded
-                    lanes[lane].label = lanes[lane].label + " \u2022"; // add dot marker
-                    repaint();
-                }
+                // Decoding runs on the processor's loader thread; the grid may be gone by the time it finishes
+                processor.loadSampleForLaneAsync(lane, file,
+                    [safeThis = juce::Component::SafePointer<MultiStepGridComponent>(this), lane, file](bool ok)
+                    {
+                        if (safeThis == nullptr)
+                            return;
+                        if (! ok)
+                        {
+                            juce::NativeMessageBox::showMessageBoxAsync(juce::AlertWindow::WarningIcon,
+                                                                        "Sample load failed",
+                                                                        "No se pudo cargar el archivo: " + file.getFileName());
+                        }
+                        else
+                        {
+                            // Simple feedback so the user knows which lane has a sample loaded
+                            safeThis->lanes[lane].label = safeThis->lanes[lane].label + " \u2022"; // add dot marker
+                            safeThis->repaint();
+                        }
+                    });
             });
     }
 
+    // Click toggles a step, right-click or Alt-click its accent; Shift-click ends the
+    // lane on that step
     void toggleFromMouse(const juce::MouseEvent& e)
     {
-        auto padArea = getLocalBounds().reduced(8);
-        int rows = lanes.size();
-        if (rows == 0) return;
-        int steps = lanes[0].seq->getNumSteps();
-        float rowGap = 6.0f;
-        float padGap = 4.0f;
-        float rowH = ((float)padArea.getHeight() - rowGap * (rows - 1)) / (float)rows;
-        float padW = ((float)padArea.getWidth() - labelW) / (float)steps - padGap;
-
-        float localY = (float)e.position.getY() - (float)padArea.getY();
-        int row = (int) ((localY) / (rowH + rowGap));
-        if (row < 0 || row >= rows) return;
-
-        float localX = (float)e.position.getX() - (float)padArea.getX() - labelW;
-        int col = (int) (localX / (padW + padGap));
-        if (col < 0 || col >= steps) return;
+        if (lanes.isEmpty()) return;
+        const auto [row, col] = getCellAt(e);
+        if (row < 0 || col < 0) return;
 
-        if (e.mods.isRightButtonDown() || e.mods.isAltDown())
+        if (e.mods.isShiftDown())
+        {
+            if (lanes[row].seq->getNumSteps() != col + 1)
+                lanes[row].seq->setNumSteps(col + 1);
+        }
+        else if (col >= lanes[row].seq->getNumSteps())
+        {
+            return;
+        }
+        else if (e.mods.isRightButtonDown() || e.mods.isAltDown())
         {
             bool acc = lanes[row].seq->getAccent(col);
             lanes[row].seq->setAccent(col, !acc);
@@ -340,15 +451,96 @@ private:
         repaint();
     }
 
+    // Shift-right-click picks the lane's step division
+    void showDivisionMenu(const juce::MouseEvent& e)
+    {
+        const int row = getCellAt(e).first;
+        if (row < 0) return;
+
+        juce::PopupMenu menu;
+        auto* seq = lanes[row].seq;
+        for (int d = 0; d < StepSequencer::NumDivisions; ++d)
+            menu.addItem(d + 1, StepSequencer::getDivisionName(d), true, seq->getDivision() == d);
+        menu.showMenuAsync(juce::PopupMenu::Options().withTargetScreenArea({ e.getScreenX(), e.getScreenY(), 1, 1 }),
+            [safeThis = juce::Component::SafePointer<MultiStepGridComponent>(this), seq](int result)
+            {
+                if (safeThis == nullptr || result <= 0)
+                    return;
+                seq->setDivision(result - 1);
+                safeThis->repaint();
+            });
+    }
+
+    // Ctrl/Cmd-click on a step that is on lists the lane's parameters: an unlocked one
+    // locks for that step at its current knob value, a locked one clears. So a lock is
+    // set by turning the knob, then picking it here.
+    void showLockMenu(const juce::MouseEvent& e)
+    {
+        const auto [row, col] = getCellAt(e);
+        if (row < 0 || col < 0 || ! lanes[row].seq->getStepOn(col))
+            return;
+
+        const auto& ids = DMParams::laneParamIds[row];
+        const char* const paramIds[] = { ids.pitch, ids.decay, ids.tone, ids.drive };
+        const char* const names[] = { "Pitch", "Decay", "Tone", "Drive" };
+        static_assert(std::size(names) == (size_t) StepLocks::NumParams, "one entry per lockable parameter");
+
+        auto* seq = lanes[row].seq;
+        const auto locks = seq->getLocks(col);
+        auto& apvts = processor.getAPVTS();
+        std::array<float, StepLocks::NumParams> knobValues {};
+
+        juce::PopupMenu menu;
+        for (int i = 0; i < StepLocks::NumParams; ++i)
+        {
+            auto* param = apvts.getParameter(paramIds[i]);
+            knobValues[(size_t) i] = apvts.getRawParameterValue(paramIds[i])->load();
+            if (locks.has((StepLocks::Index) i))
+                menu.addItem(i + 1, juce::String(names[i]) + " locked at "
+                                        + param->getText(param->convertTo0to1(locks.values[(size_t) i]), 0), true, true);
+            else
+                menu.addItem(i + 1, "Lock " + juce::String(names[i]) + " at " + param->getCurrentValueAsText());
+        }
+        menu.addSeparator();
+        menu.addItem(StepLocks::NumParams + 1, "Clear locks", locks.mask != 0);
+
+        menu.showMenuAsync(juce::PopupMenu::Options().withTargetScreenArea({ e.getScreenX(), e.getScreenY(), 1, 1 }),
+            [safeThis = juce::Component::SafePointer<MultiStepGridComponent>(this), seq, step = col, locks, knobValues](int result)
+            {
+                if (safeThis == nullptr || result <= 0)
+                    return;
+                if (result <= StepLocks::NumParams)
+                {
+                    const auto param = (StepLocks::Index) (result - 1);
+                    if (locks.has(param))
+                        seq->clearLock(step, param);
+                    else
+                        seq->setLock(step, param, knobValues[(size_t) param]);
+                }
+                else
+                {
+                    seq->applyEdits([seq, step]
+                    {
+                        for (int i = 0; i < StepLocks::NumParams; ++i)
+                            seq->clearLock(step, (StepLocks::Index) i);
+                    });
+                }
+                safeThis->repaint();
+            });
+    }
+
     void clearLane(int lane)
     {
         if (lane < 0 || lane >= lanes.size()) return;
-        int steps = lanes[lane].seq->getNumSteps();
-        for (int i = 0; i < steps; ++i)
+        auto* seq = lanes[lane].seq;
+        seq->applyEdits([seq]
         {
-            lanes[lane].seq->setStepOn(i, false);
-            lanes[lane].seq->setAccent(i, false);
-        }
+            for (int i = 0; i < seq->getNumSteps(); ++i)
+            {
+                seq->setStepOn(i, false);
+                seq->setAccent(i, false);
+            }
+        });
         repaint();
     }
 
@@ -368,13 +560,16 @@ private:
     void pasteLane(int lane)
     {
         if (lane < 0 || lane >= lanes.size()) return;
-        int steps = lanes[lane].seq->getNumSteps();
-        int n = (int) std::min<size_t>(steps, clipboardOn.size());
-        for (int i = 0; i < n; ++i)
+        auto* seq = lanes[lane].seq;
+        int n = (int) std::min<size_t>(seq->getNumSteps(), clipboardOn.size());
+        seq->applyEdits([&]
         {
-            lanes[lane].seq->setStepOn(i, clipboardOn[i]);
-            lanes[lane].seq->setAccent(i, clipboardAccent.size() > (size_t) i ? clipboardAccent[i] : false);
-        }
+            for (int i = 0; i < n; ++i)
+            {
+                seq->setStepOn(i, clipboardOn[i]);
+                seq->setAccent(i, clipboardAccent.size() > (size_t) i ? clipboardAccent[i] : false);
+            }
+        });
         repaint();
     }
 
@@ -13,9 +13,9 @@ public:
         activeSequencer = &processor.getBDSequencer();
     }
 
-    void setStepsMode(bool is32)
+    void setNumSteps(int numSteps)
     {
-        if (activeSequencer) activeSequencer->setStepsMode(is32);
+        if (activeSequencer) activeSequencer->setNumSteps(numSteps);
         repaint();
     }
 
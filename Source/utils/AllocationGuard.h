@@ -0,0 +1,37 @@
+#pragma once
+#include <JuceHeader.h>
+
+// Debug check that the audio callback never touches the heap. While a
+// ScopedNoAllocation is alive on a thread, the replacement operator new of
+// AllocationHooks.h asserts. Only executables that include the hooks, such as
+// OfflineRender, check; in the plugin the scope costs nothing and reports nothing.
+// Disabled in release builds.
+#ifndef DM_CHECK_AUDIO_ALLOCATIONS
+ #define DM_CHECK_AUDIO_ALLOCATIONS JUCE_DEBUG
+#endif
+
+namespace AllocationGuard
+{
+    inline thread_local bool allocationForbidden = false;
+
+    inline void checkAllocation() noexcept
+    {
+        if (allocationForbidden)
+        {
+            allocationForbidden = false; // reporting the assertion may allocate
+            jassertfalse;                // heap allocation on the audio thread
+            allocationForbidden = true;
+        }
+    }
+
+    struct ScopedNoAllocation
+    {
+        ScopedNoAllocation() noexcept : previous(allocationForbidden) { allocationForbidden = true; }
+        ~ScopedNoAllocation() noexcept { allocationForbidden = previous; }
+
+        ScopedNoAllocation(const ScopedNoAllocation&) = delete;
+        ScopedNoAllocation& operator=(const ScopedNoAllocation&) = delete;
+
+        bool previous;
+    };
+}
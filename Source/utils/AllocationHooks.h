@@ -0,0 +1,74 @@
+#pragma once
+#include "AllocationGuard.h"
+#include <new>
+
+// Replacement global allocation functions that report heap use inside an
+// AllocationGuard::ScopedNoAllocation. Replacing operator new is only well defined
+// in an executable, so include this from exactly one translation unit of a tool
+// such as OfflineRender, never from the plugin: loaded into a host it would either
+// take over the host's allocator or never be called at all.
+#if DM_CHECK_AUDIO_ALLOCATIONS
+
+namespace AllocationGuard::detail
+{
+    inline void* allocate(std::size_t size)
+    {
+        checkAllocation();
+        if (auto* ptr = std::malloc(size == 0 ? 1 : size))
+            return ptr;
+        throw std::bad_alloc();
+    }
+
+    // Over-allocates and keeps the malloc pointer just below the aligned block
+    inline void* allocateAligned(std::size_t size, std::align_val_t alignment)
+    {
+        const auto align = juce::jmax((std::size_t) alignment, alignof(void*));
+        auto* raw = static_cast<char*>(allocate(size + align + sizeof(void*)));
+        const auto address = (reinterpret_cast<std::uintptr_t>(raw) + sizeof(void*) + align - 1) & ~(std::uintptr_t) (align - 1);
+        auto* aligned = reinterpret_cast<void**>(address);
+        aligned[-1] = raw;
+        return aligned;
+    }
+
+    inline void freeAligned(void* ptr) noexcept
+    {
+        if (ptr != nullptr)
+            std::free(static_cast<void**>(ptr)[-1]);
+    }
+}
+
+void* operator new   (std::size_t size)                        { return AllocationGuard::detail::allocate(size); }
+void* operator new[] (std::size_t size)                        { return AllocationGuard::detail::allocate(size); }
+void* operator new   (std::size_t size, const std::nothrow_t&) noexcept
+{
+    try { return AllocationGuard::detail::allocate(size); } catch (...) { return nullptr; }
+}
+void* operator new[] (std::size_t size, const std::nothrow_t&) noexcept
+{
+    try { return AllocationGuard::detail::allocate(size); } catch (...) { return nullptr; }
+}
+void operator delete   (void* ptr) noexcept                               { std::free(ptr); }
+void operator delete[] (void* ptr) noexcept                               { std::free(ptr); }
+void operator delete   (void* ptr, std::size_t) noexcept                  { std::free(ptr); }
+void operator delete[] (void* ptr, std::size_t) noexcept                  { std::free(ptr); }
+void operator delete   (void* ptr, const std::nothrow_t&) noexcept        { std::free(ptr); }
+void operator delete[] (void* ptr, const std::nothrow_t&) noexcept        { std::free(ptr); }
+
+void* operator new   (std::size_t size, std::align_val_t align)           { return AllocationGuard::detail::allocateAligned(size, align); }
+void* operator new[] (std::size_t size, std::align_val_t align)           { return AllocationGuard::detail::allocateAligned(size, align); }
+void* operator new   (std::size_t size, std::align_val_t align, const std::nothrow_t&) noexcept
+{
+    try { return AllocationGuard::detail::allocateAligned(size, align); } catch (...) { return nullptr; }
+}
+void* operator new[] (std::size_t size, std::align_val_t align, const std::nothrow_t&) noexcept
+{
+    try { return AllocationGuard::detail::allocateAligned(size, align); } catch (...) { return nullptr; }
+}
+void operator delete   (void* ptr, std::align_val_t) noexcept                        { AllocationGuard::detail::freeAligned(ptr); }
+void operator delete[] (void* ptr, std::align_val_t) noexcept                        { AllocationGuard::detail::freeAligned(ptr); }
+void operator delete   (void* ptr, std::size_t, std::align_val_t) noexcept           { AllocationGuard::detail::freeAligned(ptr); }
+void operator delete[] (void* ptr, std::size_t, std::align_val_t) noexcept           { AllocationGuard::detail::freeAligned(ptr); }
+void operator delete   (void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { AllocationGuard::detail::freeAligned(ptr); }
+void operator delete[] (void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { AllocationGuard::detail::freeAligned(ptr); }
+
+#endif
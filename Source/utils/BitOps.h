@@ -0,0 +1,33 @@
+#pragma once
+#include <JuceHeader.h>
+#if JUCE_MSVC
+ #include <intrin.h>
+#endif
+
+namespace BitOps
+{
+    // Index of the lowest set bit. The argument must be non-zero.
+    inline int countTrailingZeros(juce::uint32 x) noexcept
+    {
+        jassert(x != 0);
+       #if JUCE_MSVC
+        unsigned long index;
+        _BitScanForward(&index, x);
+        return (int) index;
+       #else
+        return __builtin_ctz(x);
+       #endif
+    }
+
+    inline int countTrailingZeros(juce::uint64 x) noexcept
+    {
+        jassert(x != 0);
+       #if JUCE_MSVC
+        unsigned long index;
+        _BitScanForward64(&index, x);
+        return (int) index;
+       #else
+        return __builtin_ctzll(x);
+       #endif
+    }
+}
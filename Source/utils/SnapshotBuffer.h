@@ -0,0 +1,37 @@
+#pragma once
+#include <JuceHeader.h>
+
+// Wait-free hand-over of a small copyable value from one writer thread to one reader
+// thread, as a triple buffer. One slot belongs to the writer, one to the reader and
+// the third holds the latest published value. Publishing swaps the writer's slot with
+// the latest; reading swaps the latest for the reader's slot, but only when something
+// new was published, so an unchanged value costs the reader a single atomic load.
+// Neither side waits or allocates, and neither ever sees a slot the other is writing.
+template <typename T>
+class SnapshotBuffer
+{
+public:
+    // Writer: fill this slot completely, then publish() it
+    T& getWriteSlot() noexcept { return slots[(size_t) writeIndex]; }
+
+    void publish() noexcept
+    {
+        writeIndex = latest.exchange(writeIndex | newFlag, std::memory_order_acq_rel) & indexMask;
+    }
+
+    // Reader: the newest published value, which stays valid until the next read()
+    const T& read() noexcept
+    {
+        if ((latest.load(std::memory_order_relaxed) & newFlag) != 0)
+            readIndex = latest.exchange(readIndex, std::memory_order_acq_rel) & indexMask;
+        return slots[(size_t) readIndex];
+    }
+
+private:
+    static constexpr int indexMask = 3, newFlag = 4;
+
+    std::array<T, 3> slots {};
+    int writeIndex { 0 };
+    int readIndex { 1 };
+    std::atomic<int> latest { 2 };
+};
@@ -1,125 +1,202 @@
 #pragma once
 #include <JuceHeader.h>
+#include "VoiceRamps.h"
+#include "VoiceRender.h"
+#include "VoiceLocks.h"
+#include "../dsp/FastSine.h"
 
-class BDVoice
+class BDVoice : public LockableVoice<BDVoice>
 {
 public:
+    // Values derived from the lane parameters. The processor keeps one set per lane,
+    // recomputes only the parts whose parameter moved and copies it into the voices.
+    struct Coeffs
+    {
+        void setPitch(float pitchSemitones, double) { baseFreq = 55.0f * std::pow(2.0f, pitchSemitones / 12.0f); }
+
+        void setDecay(float decaySeconds, double sr)
+        {
+            const float decayTime = juce::jlimit(0.01f, 4.0f, decaySeconds);
+            ampEnvMult = std::exp(-1.0f / (decayTime * (float)sr));
+        }
+
+        void setTone(float tone, double sr)
+        {
+            float cutoff = juce::jmap(juce::jlimit(0.0f, 1.0f, tone), 400.0f, 4000.0f);
+            lp_b = std::exp(-2.0f * juce::MathConstants<float>::pi * cutoff / (float)sr);
+        }
+
+        void setDrive(float drive, double) { driveAmount = juce::jlimit(0.0f, 1.0f, drive); }
+
+        // Value smoothed per sample for each VoiceRamps index
+        float getRampValue(VoiceRamps::Index i) const
+        {
+            switch (i)
+            {
+                case VoiceRamps::Pitch: return baseFreq;
+                case VoiceRamps::Decay: return ampEnvMult;
+                case VoiceRamps::Tone:  return lp_b;
+                case VoiceRamps::Drive: return driveAmount;
+                default: return 0.0f;
+            }
+        }
+
+        // Copies the values derived from the parameters in mask
+        void copyFrom(const Coeffs& c, juce::uint32 mask)
+        {
+            if (VoiceRamps::has(mask, VoiceRamps::Pitch)) baseFreq = c.baseFreq;
+            if (VoiceRamps::has(mask, VoiceRamps::Decay)) ampEnvMult = c.ampEnvMult;
+            if (VoiceRamps::has(mask, VoiceRamps::Tone))  lp_b = c.lp_b;
+            if (VoiceRamps::has(mask, VoiceRamps::Drive)) driveAmount = c.driveAmount;
+        }
+
+        float baseFreq { 55.0f };
+        float ampEnvMult { 0.995f };
+        float lp_b { 0.0f }; // one-pole feedback, the input gain is 1 - lp_b
+        float driveAmount { 0.0f };
+    };
+
     void prepare(double sr)
     {
         sampleRate = sr;
+        chokeEnvMult = std::exp(-1.0f / (0.004f * (float)sampleRate));
+        // exp(-6 t / 20 ms) as a per-sample multiplier, held once the sweep ends
+        sweepLength = (int) std::ceil(0.02 * sampleRate);
+        sweepMult = std::exp(-6.0f / (0.02f * (float)sampleRate));
+        clickLength = 0.003f * (float)sampleRate;
         reset();
     }
 
-    void setParameters(float pitchSemitones, float decaySeconds, float tone, float drive)
+    void setCoefficients(const Coeffs& c)
     {
-        baseFreq = 55.0f * std::pow(2.0f, pitchSemitones / 12.0f);
-        decayTime = juce::jlimit(0.01f, 4.0f, decaySeconds);
-        toneAmount = juce::jlimit(0.0f, 1.0f, tone);
-        driveAmount = juce::jlimit(0.0f, 1.0f, drive);
-        ampEnvMult = std::exp(-1.0f / (decayTime * (float)sampleRate));
-        float cutoff = juce::jmap(toneAmount, 400.0f, 4000.0f);
-        float x = std::exp(-2.0f * juce::MathConstants<float>::pi * cutoff / (float)sampleRate);
-        lp_a = 1.0f - x;
-        lp_b = x;
+        coeffs = c;
+        ampEnvMult = choked ? chokeEnvMult : coeffs.ampEnvMult;
     }
 
-    void noteOn(float velocity)
+    const Coeffs& getCoefficients() const { return coeffs; }
+
+    void setParameters(float pitchSemitones, float decaySeconds, float tone, float drive)
     {
-        noteOnWithDelay(velocity, 0);
+        Coeffs c;
+        c.setPitch(pitchSemitones, sampleRate);
+        c.setDecay(decaySeconds, sampleRate);
+        c.setTone(tone, sampleRate);
+        c.setDrive(drive, sampleRate);
+        setCoefficients(c);
     }
 
-    void noteOnWithDelay(float velocity, int delaySamples)
+    void noteOn(float velocity)
     {
-        startDelaySamples = juce::jmax(0, delaySamples);
         active = true;
+        choked = false;
+        ampEnvMult = coeffs.ampEnvMult;
         ampEnv = juce::jlimit(0.0f, 1.0f, velocity);
-        sweepPhase = 0.0f;
-        clickSamples = (int)(0.003f * sampleRate);
-        sweepStartFreq = baseFreq * 1.6f;
-        sweepEndFreq = baseFreq;
+        sweepEnv = 1.0f;
+        sweepSamples = sweepLength;
+        clickSamples = (int)clickLength;
     }
 
-    void render(juce::AudioBuffer<float>& buffer, int startSample, int numSamples)
+    // Ramps are indexed by buffer position, so they cover the whole block from sample 0
+    void render(juce::AudioBuffer<float>& buffer, int startSample, int numSamples, const VoiceRamps& ramps = {})
     {
         if (!active) return;
-        auto* left  = buffer.getWritePointer(0);
-        auto* right = buffer.getNumChannels() > 1 ? buffer.getWritePointer(1) : nullptr;
+        VoiceRender::render(*this, buffer, startSample, numSamples, ramps, coeffs.driveAmount, driveGain);
+    }
+
+    bool isActive() const { return active; }
+    float getLevel() const { return active ? ampEnv : 0.0f; }
 
-        for (int i = 0; i < numSamples; ++i)
+    // Fast fade-out used when the voice is stolen or choked
+    void choke()
+    {
+        choked = true;
+        ampEnvMult = chokeEnvMult;
+        clickSamples = 0;
+    }
+
+    void reset()
+    {
+        active = false;
+        choked = false;
+        coeffs = {};
+        setLockMask(0);
+        phase = 0.0f;
+        ampEnv = 0.0f;
+        ampEnvMult = coeffs.ampEnvMult;
+        lp_y = 0.0f;
+        clickSamples = 0;
+        sweepEnv = 1.0f;
+        sweepSamples = 0;
+    }
+
+    // Writes up to maxSamples undriven samples to dest; returns how many before the voice ended.
+    // Called by VoiceRender, which applies the drive and mixes into the buffer.
+    template <bool Ramped>
+    int renderMono(float* dest, int startSample, int maxSamples, const VoiceRamps& ramps)
+    {
+        const bool rampPitch = Ramped && followsRamp(VoiceRamps::Pitch);
+        const bool rampTone  = Ramped && followsRamp(VoiceRamps::Tone);
+        const bool rampDecay = Ramped && followsRamp(VoiceRamps::Decay);
+
+        int i = 0;
+        while (i < maxSamples)
         {
             int idx = startSample + i;
+            const float baseFreq = rampPitch ? ramps[VoiceRamps::Pitch][idx] : coeffs.baseFreq;
+            const float lp_b     = rampTone  ? ramps[VoiceRamps::Tone][idx]  : coeffs.lp_b;
+            const float envMult  = rampDecay && !choked ? ramps[VoiceRamps::Decay][idx] : ampEnvMult;
 
-            if (startDelaySamples > 0)
-            {
-                --startDelaySamples;
-                continue;
-            }
-
-            float sweepDur = 0.02f;
-            float sweepAlpha = juce::jlimit(0.0f, 1.0f, sweepPhase / (sweepDur * (float)sampleRate));
-            float instFreq = sweepEndFreq + (sweepStartFreq - sweepEndFreq) * std::exp(-6.0f * sweepAlpha);
+            // Pitch sweeps from 1.6x down to the base frequency
+            float instFreq = baseFreq * (1.0f + 0.6f * sweepEnv);
             phase += instFreq / (float)sampleRate;
             if (phase >= 1.0f) phase -= 1.0f;
-            float s = std::sin(phase * juce::MathConstants<float>::twoPi);
+            float s = FastSine::sin2pi(phase);
 
-            lp_y = lp_a * s + lp_b * lp_y;
+            lp_y = (1.0f - lp_b) * s + lp_b * lp_y;
             float out = lp_y * ampEnv;
 
             if (clickSamples > 0)
             {
-                out += 0.25f * ampEnv * (float)clickSamples / (0.003f * (float)sampleRate);
+                out += 0.25f * ampEnv * (float)clickSamples / clickLength;
                 --clickSamples;
             }
 
-            if (driveAmount > 0.001f)
-                out = juce::jmap(driveAmount, out, std::tanh(out * (1.0f + 2.5f * driveAmount)));
+            dest[i++] = out;
 
-            left[idx] += out;
-            if (right) right[idx] += out;
-
-            ampEnv *= ampEnvMult;
-            sweepPhase += 1.0f;
+            ampEnv *= envMult;
+            if (sweepSamples > 0)
+            {
+                sweepEnv *= sweepMult;
+                --sweepSamples;
+            }
             if (ampEnv < 1e-4f)
             {
                 active = false;
                 break;
             }
         }
-    }
-
-    void reset()
-    {
-        active = false;
-        phase = 0.0f;
-        ampEnv = 0.0f;
-        ampEnvMult = 0.995f;
-        lp_y = 0.0f; lp_a = 1.0f; lp_b = 0.0f;
-        clickSamples = 0;
-        startDelaySamples = 0;
-        sweepPhase = 0.0f;
-        baseFreq = 55.0f; decayTime = 0.5f; toneAmount = 0.5f; driveAmount = 0.0f;
-        sweepStartFreq = 80.0f; sweepEndFreq = 55.0f;
+        return i;
     }
 
 private:
+    static constexpr float driveGain = 2.5f;
+
     double sampleRate { 44100.0 };
     bool active { false };
+    bool choked { false };
+    Coeffs coeffs;
 
     float phase { 0.0f };
 
     float ampEnv { 0.0f };
     float ampEnvMult { 0.995f };
+    float chokeEnvMult { 0.995f };
 
-    float lp_y { 0.0f }, lp_a { 1.0f }, lp_b { 0.0f };
+    float lp_y { 0.0f };
 
     int clickSamples { 0 };
-    int startDelaySamples { 0 };
-
-    float sweepPhase { 0.0f };
-    float baseFreq { 55.0f };
-    float decayTime { 0.5f };
-    float toneAmount { 0.5f };
-    float driveAmount { 0.0f };
-    float sweepStartFreq { 80.0f };
-    float sweepEndFreq { 55.0f };
-};
\ No newline at end of file
+    float clickLength { 132.3f };
+
+    float sweepEnv { 1.0f }, sweepMult { 1.0f };
+    int sweepSamples { 0 }, sweepLength { 0 };
+};
@@ -1,99 +1,171 @@
 #pragma once
 #include <JuceHeader.h>
+#include "VoiceRamps.h"
+#include "VoiceRender.h"
+#include "VoiceLocks.h"
 
-class ClapVoice
+class ClapVoice : public LockableVoice<ClapVoice>
 {
 public:
-    void prepare(double sr) { sampleRate = sr; reset(); }
+    // Values derived from the lane parameters, shared by every voice of a lane
+    struct Coeffs
+    {
+        void setPitch(float, double) {}
+
+        void setDecay(float decaySec, double sr)
+        {
+            const float decayTime = juce::jlimit(0.05f, 1.5f, decaySec);
+            ampEnvMult = std::exp(-1.0f / (decayTime * (float)sr));
+            pulseGapSamples = (int) (0.008f * sr);
+        }
+
+        void setTone(float tone, double sr)
+        {
+            float cutoff = juce::jmap(juce::jlimit(0.0f, 1.0f, tone), 1500.0f, 6000.0f);
+            lp_b = std::exp(-2.0f * juce::MathConstants<float>::pi * cutoff / (float)sr);
+        }
+
+        void setDrive(float drive, double) { driveAmount = juce::jlimit(0.0f, 1.0f, drive); }
+
+        float getRampValue(VoiceRamps::Index i) const
+        {
+            switch (i)
+            {
+                case VoiceRamps::Decay: return ampEnvMult;
+                case VoiceRamps::Tone:  return lp_b;
+                case VoiceRamps::Drive: return driveAmount;
+                default: return 0.0f;
+            }
+        }
+
+        void copyFrom(const Coeffs& c, juce::uint32 mask)
+        {
+            if (VoiceRamps::has(mask, VoiceRamps::Decay)) { ampEnvMult = c.ampEnvMult; pulseGapSamples = c.pulseGapSamples; }
+            if (VoiceRamps::has(mask, VoiceRamps::Tone))  lp_b = c.lp_b;
+            if (VoiceRamps::has(mask, VoiceRamps::Drive)) driveAmount = c.driveAmount;
+        }
+
+        float ampEnvMult { 0.995f };
+        float lp_b { 0.0f }; // the input gain is 1 - lp_b
+        float driveAmount { 0.0f };
+        int pulseGapSamples { 0 };
+    };
+
+    void prepare(double sr)
+    {
+        sampleRate = sr;
+        chokeEnvMult = std::exp(-1.0f / (0.004f * (float)sampleRate));
+        reset();
+    }
+
+    void setCoefficients(const Coeffs& c)
+    {
+        coeffs = c;
+        ampEnvMult = choked ? chokeEnvMult : coeffs.ampEnvMult;
+    }
+
+    const Coeffs& getCoefficients() const { return coeffs; }
 
     void setParameters(float pitchSemi, float decaySec, float tone, float drive)
     {
-        decayTime = juce::jlimit(0.05f, 1.5f, decaySec);
-        toneAmount = juce::jlimit(0.0f, 1.0f, tone);
-        driveAmount = juce::jlimit(0.0f, 1.0f, drive);
-        ampEnvMult = std::exp(-1.0f / (decayTime * (float)sampleRate));
-        float cutoff = juce::jmap(toneAmount, 1500.0f, 6000.0f);
-        float x = std::exp(-2.0f * juce::MathConstants<float>::pi * cutoff / (float)sampleRate);
-        lp_a = 1.0f - x; lp_b = x;
-        pulses = 4; pulseGapSamples = (int) (0.008f * sampleRate);
-        juce::ignoreUnused(pitchSemi);
+        Coeffs c;
+        c.setPitch(pitchSemi, sampleRate);
+        c.setDecay(decaySec, sampleRate);
+        c.setTone(tone, sampleRate);
+        c.setDrive(drive, sampleRate);
+        setCoefficients(c);
     }
 
     void noteOn(float velocity)
     {
         active = true;
+        choked = false;
+        ampEnvMult = coeffs.ampEnvMult;
         ampEnv = juce::jlimit(0.0f, 1.0f, velocity);
         noiseState = 0x7654321u;
         currentPulse = 0; pulseCountdown = 0;
     }
 
-    void noteOnWithDelay(float velocity, int delaySamples)
+    void render(juce::AudioBuffer<float>& buffer, int startSample, int numSamples, const VoiceRamps& ramps = {})
     {
-        startDelaySamples = juce::jmax(0, delaySamples);
-        noteOn(velocity);
+        if (!active) return;
+        VoiceRender::render(*this, buffer, startSample, numSamples, ramps, coeffs.driveAmount, driveGain);
     }
 
-    void render(juce::AudioBuffer<float>& buffer, int startSample, int numSamples)
+    bool isActive() const { return active; }
+    float getLevel() const { return active ? ampEnv : 0.0f; }
+
+    // Fast fade-out used when the voice is choked; no further pulses are emitted
+    void choke()
     {
-        if (!active) return;
-        auto* L = buffer.getWritePointer(0);
-        auto* R = buffer.getNumChannels() > 1 ? buffer.getWritePointer(1) : nullptr;
-        for (int i = 0; i < numSamples; ++i)
+        choked = true;
+        ampEnvMult = chokeEnvMult;
+        currentPulse = pulses;
+    }
+
+    void reset()
+    {
+        active = false; choked = false; currentPulse = 0; pulseCountdown = 0;
+        coeffs = {}; setLockMask(0);
+        ampEnv = 0.0f; ampEnvMult = coeffs.ampEnvMult;
+        lp_y = 0.0f;
+    }
+
+    // Writes up to maxSamples undriven samples to dest; returns how many before the voice ended
+    template <bool Ramped>
+    int renderMono(float* dest, int startSample, int maxSamples, const VoiceRamps& ramps)
+    {
+        const bool rampTone  = Ramped && followsRamp(VoiceRamps::Tone);
+        const bool rampDecay = Ramped && followsRamp(VoiceRamps::Decay);
+
+        int i = 0;
+        for (; i < maxSamples; ++i)
         {
             int idx = startSample + i;
-            if (startDelaySamples > 0) { --startDelaySamples; continue; }
             if (currentPulse >= pulses && ampEnv < 1e-4f) { active = false; break; }
 
+            const float envMult = rampDecay && !choked ? ramps[VoiceRamps::Decay][idx] : ampEnvMult;
+
             float out = 0.0f;
             if (pulseCountdown <= 0 && currentPulse < pulses)
             {
+                const float lp_b = rampTone ? ramps[VoiceRamps::Tone][idx] : coeffs.lp_b;
                 // emit short noise pulse
                 for (int k = 0; k < 4; ++k)
                 {
                     float n = (float)((noiseState = noiseState * 1103515245u + 12345u) & 0x00ffffff) / (float)0x00ffffff;
                     n = n * 2.0f - 1.0f;
-                    lp_y = lp_a * n + lp_b * lp_y;
+                    lp_y = (1.0f - lp_b) * n + lp_b * lp_y;
                     out += lp_y * ampEnv * 0.25f;
                 }
                 ++currentPulse;
-                pulseCountdown = pulseGapSamples;
+                pulseCountdown = coeffs.pulseGapSamples;
             }
             else
             {
                 --pulseCountdown;
             }
 
-            if (driveAmount > 0.001f)
-                out = juce::jmap(driveAmount, out, std::tanh(out * (1.0f + 2.5f * driveAmount)));
-
-            L[idx] += out;
-            if (R) R[idx] += out;
+            dest[i] = out;
 
-            ampEnv *= ampEnvMult;
+            ampEnv *= envMult;
         }
-    }
-
-    void reset()
-    {
-        active = false; startDelaySamples = 0; currentPulse = 0; pulseCountdown = 0;
-        ampEnv = 0.0f; ampEnvMult = 0.995f;
-        lp_y = 0.0f; lp_a = 1.0f; lp_b = 0.0f;
-        toneAmount = 0.5f; decayTime = 0.3f; driveAmount = 0.0f;
-        pulses = 4; pulseGapSamples = 0;
+        return i;
     }
 
 private:
+    static constexpr int pulses = 4;
+    static constexpr float driveGain = 2.5f;
+
     double sampleRate { 44100.0 };
     bool active { false };
+    bool choked { false };
+    Coeffs coeffs;
 
-    float decayTime { 0.3f };
-    float toneAmount { 0.5f };
-    float driveAmount { 0.0f };
-    float ampEnv { 0.0f }, ampEnvMult { 0.995f };
+    float ampEnv { 0.0f }, ampEnvMult { 0.995f }, chokeEnvMult { 0.995f };
 
-    float lp_y { 0.0f }, lp_a { 1.0f }, lp_b { 0.0f };
+    float lp_y { 0.0f };
     unsigned int noiseState { 1u };
 
-    int startDelaySamples { 0 };
-    int pulses { 4 }, currentPulse { 0 }, pulseGapSamples { 0 }, pulseCountdown { 0 };
-};
\ No newline at end of file
+    int currentPulse { 0 }, pulseCountdown { 0 };
+};
@@ -1,89 +1,159 @@
 #pragma once
 #include <JuceHeader.h>
+#include "VoiceRamps.h"
+#include "VoiceRender.h"
+#include "VoiceLocks.h"
 
-class HHVoice
+class HHVoice : public LockableVoice<HHVoice>
 {
 public:
     enum Type { Closed, Open };
 
-    HHVoice(Type t) : type(t) {}
+    // Values derived from the lane parameters, shared by every voice of a lane
+    struct Coeffs
+    {
+        // Pitch does not change the noise source yet
+        void setPitch(float, double) {}
+
+        void setDecay(float decaySeconds, double sr)
+        {
+            const float decayTime = juce::jlimit(0.01f, 2.0f, decaySeconds);
+            ampEnvMult = std::exp(-1.0f / (decayTime * (float)sr));
+        }
+
+        // simple HP/BP filter
+        void setTone(float tone, double sr)
+        {
+            float cutoff = juce::jmap(juce::jlimit(0.0f, 1.0f, tone), 3000.0f, 10000.0f);
+            hp_b = std::exp(-2.0f * juce::MathConstants<float>::pi * cutoff / (float)sr);
+        }
+
+        void setDrive(float drive, double) { driveAmount = juce::jlimit(0.0f, 1.0f, drive); }
+
+        float getRampValue(VoiceRamps::Index i) const
+        {
+            switch (i)
+            {
+                case VoiceRamps::Decay: return ampEnvMult;
+                case VoiceRamps::Tone:  return hp_b;
+                case VoiceRamps::Drive: return driveAmount;
+                default: return 0.0f;
+            }
+        }
+
+        void copyFrom(const Coeffs& c, juce::uint32 mask)
+        {
+            if (VoiceRamps::has(mask, VoiceRamps::Decay)) ampEnvMult = c.ampEnvMult;
+            if (VoiceRamps::has(mask, VoiceRamps::Tone))  hp_b = c.hp_b;
+            if (VoiceRamps::has(mask, VoiceRamps::Drive)) driveAmount = c.driveAmount;
+        }
+
+        float ampEnvMult { 0.995f };
+        float hp_b { 0.0f }; // the input gain is 1 - hp_b
+        float driveAmount { 0.0f };
+    };
+
+    HHVoice(Type t = Closed) : type(t) {}
 
-    void prepare(double sr) { sampleRate = sr; reset(); }
+    void prepare(double sr)
+    {
+        sampleRate = sr;
+        chokeEnvMult = std::exp(-1.0f / (0.004f * (float)sampleRate));
+        reset();
+    }
+
+    void setCoefficients(const Coeffs& c)
+    {
+        coeffs = c;
+        ampEnvMult = choked ? chokeEnvMult : coeffs.ampEnvMult;
+    }
+
+    const Coeffs& getCoefficients() const { return coeffs; }
 
     void setParameters(float pitchSemi, float decaySec, float tone, float drive)
     {
-        baseFreq = 8000.0f * std::pow(2.0f, pitchSemi / 12.0f);
-        decayTime = juce::jlimit(0.01f, 2.0f, decaySec);
-        toneAmount = juce::jlimit(0.0f, 1.0f, tone);
-        driveAmount = juce::jlimit(0.0f, 1.0f, drive);
-        ampEnvMult = std::exp(-1.0f / (decayTime * (float)sampleRate));
-        // simple HP/BP filter
-        float cutoff = juce::jmap(toneAmount, 3000.0f, 10000.0f);
-        float x = std::exp(-2.0f * juce::MathConstants<float>::pi * cutoff / (float)sampleRate);
-        hp_a = 1.0f - x; hp_b = x;
+        Coeffs c;
+        c.setPitch(pitchSemi, sampleRate);
+        c.setDecay(decaySec, sampleRate);
+        c.setTone(tone, sampleRate);
+        c.setDrive(drive, sampleRate);
+        setCoefficients(c);
     }
 
     void noteOn(float velocity)
     {
         active = true;
+        choked = false;
+        ampEnvMult = coeffs.ampEnvMult;
         ampEnv = juce::jlimit(0.0f, 1.0f, velocity);
         noiseState = 0xabcdefu;
         remainingSamples = type == Closed ? (int)(0.03 * sampleRate) : (int)(0.25 * sampleRate);
     }
 
-    void noteOnWithDelay(float velocity, int delaySamples)
+    void render(juce::AudioBuffer<float>& buffer, int startSample, int numSamples, const VoiceRamps& ramps = {})
     {
-        startDelaySamples = juce::jmax(0, delaySamples);
-        noteOn(velocity);
+        if (!active) return;
+        VoiceRender::render(*this, buffer, startSample, numSamples, ramps, coeffs.driveAmount, driveGain);
     }
 
-    void render(juce::AudioBuffer<float>& buffer, int startSample, int numSamples)
+    bool isActive() const { return active; }
+    float getLevel() const { return active ? ampEnv : 0.0f; }
+
+    // Fast fade-out, e.g. an open hat cut by the closed hat
+    void choke()
     {
-        if (!active) return;
-        auto* L = buffer.getWritePointer(0);
-        auto* R = buffer.getNumChannels() > 1 ? buffer.getWritePointer(1) : nullptr;
-        for (int i = 0; i < numSamples; ++i)
+        choked = true;
+        ampEnvMult = chokeEnvMult;
+        remainingSamples = juce::jmin(remainingSamples, (int)(0.02 * sampleRate));
+    }
+
+    void reset()
+    {
+        active = false; choked = false; remainingSamples = 0;
+        coeffs = {}; setLockMask(0);
+        ampEnv = 0.0f; ampEnvMult = coeffs.ampEnvMult; hp_y = 0.0f;
+    }
+
+    // Writes up to maxSamples undriven samples to dest; returns how many before the voice ended
+    template <bool Ramped>
+    int renderMono(float* dest, int startSample, int maxSamples, const VoiceRamps& ramps)
+    {
+        const bool rampTone  = Ramped && followsRamp(VoiceRamps::Tone);
+        const bool rampDecay = Ramped && followsRamp(VoiceRamps::Decay);
+
+        int i = 0;
+        for (; i < maxSamples; ++i)
         {
             int idx = startSample + i;
-            if (startDelaySamples > 0) { --startDelaySamples; continue; }
             if (remainingSamples <= 0) { active = false; break; }
 
+            const float hp_b    = rampTone ? ramps[VoiceRamps::Tone][idx]  : coeffs.hp_b;
+            const float envMult = rampDecay && !choked ? ramps[VoiceRamps::Decay][idx] : ampEnvMult;
+
             float n = (float)((noiseState = noiseState * 1103515245u + 12345u) & 0x00ffffff) / (float)0x00ffffff;
             n = n * 2.0f - 1.0f;
-            hp_y = hp_a * n + hp_b * hp_y;
+            hp_y = (1.0f - hp_b) * n + hp_b * hp_y;
             float out = hp_y * ampEnv;
 
-            if (driveAmount > 0.001f)
-                out = juce::jmap(driveAmount, out, std::tanh(out * (1.0f + 3.0f * driveAmount)));
+            dest[i] = out;
 
-            L[idx] += out;
-            if (R) R[idx] += out;
-
-            ampEnv *= ampEnvMult;
+            ampEnv *= envMult;
             --remainingSamples;
         }
-    }
-
-    void reset()
-    {
-        active = false; startDelaySamples = 0; remainingSamples = 0;
-        ampEnv = 0.0f; ampEnvMult = 0.995f; hp_y = 0.0f; hp_a = 1.0f; hp_b = 0.0f;
-        baseFreq = 8000.0f; toneAmount = 0.5f; decayTime = 0.1f; driveAmount = 0.0f;
+        return i;
     }
 
 private:
+    static constexpr float driveGain = 3.0f;
+
     Type type { Closed };
     double sampleRate { 44100.0 };
     bool active { false };
+    bool choked { false };
+    Coeffs coeffs;
 
-    float baseFreq { 8000.0f };
-    float decayTime { 0.1f };
-    float toneAmount { 0.5f };
-    float driveAmount { 0.0f };
-
-    float ampEnv { 0.0f }, ampEnvMult { 0.995f };
-    float hp_y { 0.0f }, hp_a { 1.0f }, hp_b { 0.0f };
-    int startDelaySamples { 0 };
+    float ampEnv { 0.0f }, ampEnvMult { 0.995f }, chokeEnvMult { 0.995f };
+    float hp_y { 0.0f };
     int remainingSamples { 0 };
     unsigned int noiseState { 1u };
-};
\ No newline at end of file
+};
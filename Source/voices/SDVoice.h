@@ -1,78 +1,168 @@
 #pragma once
 #include <JuceHeader.h>
+#include "VoiceRamps.h"
+#include "VoiceRender.h"
+#include "VoiceLocks.h"
+#include "../dsp/FastSine.h"
 
-class SDVoice
+class SDVoice : public LockableVoice<SDVoice>
 {
 public:
-    void prepare(double sr) { sampleRate = sr; reset(); }
+    // Values derived from the lane parameters, shared by every voice of a lane
+    struct Coeffs
+    {
+        void setPitch(float pitchSemi, double) { baseFreq = 180.0f * std::pow(2.0f, pitchSemi / 12.0f); }
+
+        void setDecay(float decaySec, double sr)
+        {
+            const float decayTime = juce::jlimit(0.02f, 2.5f, decaySec);
+            bodyEnvMult = std::exp(-1.0f / (decayTime * (float)sr));
+            snappyEnvMult = std::exp(-1.0f / (0.03f * (float)sr));
+        }
+
+        // Bandpass for tone: center 1k..3k, Q 0.7. A TPT state variable filter has the
+        // same response as the cookbook biquad but stays well behaved while g is ramped.
+        void setTone(float tone, double sr)
+        {
+            float center = juce::jmap(juce::jlimit(0.0f, 1.0f, tone), 1000.0f, 3000.0f);
+            g = std::tan(juce::MathConstants<float>::pi * center / (float)sr);
+            a1 = svfA1(g);
+        }
+
+        void setDrive(float drive, double) { driveAmount = juce::jlimit(0.0f, 1.0f, drive); }
+
+        float getRampValue(VoiceRamps::Index i) const
+        {
+            switch (i)
+            {
+                case VoiceRamps::Pitch: return baseFreq;
+                case VoiceRamps::Decay: return bodyEnvMult;
+                case VoiceRamps::Tone:  return g;
+                case VoiceRamps::Drive: return driveAmount;
+                default: return 0.0f;
+            }
+        }
+
+        static constexpr float k = 1.0f / 0.7f;
+        static float svfA1(float gain) { return 1.0f / (1.0f + gain * (gain + k)); }
+
+        void copyFrom(const Coeffs& c, juce::uint32 mask)
+        {
+            if (VoiceRamps::has(mask, VoiceRamps::Pitch)) baseFreq = c.baseFreq;
+            if (VoiceRamps::has(mask, VoiceRamps::Decay)) { bodyEnvMult = c.bodyEnvMult; snappyEnvMult = c.snappyEnvMult; }
+            if (VoiceRamps::has(mask, VoiceRamps::Tone))  { g = c.g; a1 = c.a1; }
+            if (VoiceRamps::has(mask, VoiceRamps::Drive)) driveAmount = c.driveAmount;
+        }
+
+        float baseFreq { 180.0f };
+        float bodyEnvMult { 0.995f }, snappyEnvMult { 0.95f };
+        float g { 0.0f }, a1 { 1.0f };
+        float driveAmount { 0.0f };
+    };
+
+    void prepare(double sr)
+    {
+        sampleRate = sr;
+        chokeEnvMult = std::exp(-1.0f / (0.004f * (float)sampleRate));
+        reset();
+    }
+
+    void setCoefficients(const Coeffs& c)
+    {
+        coeffs = c;
+        bodyEnvMult   = choked ? chokeEnvMult : coeffs.bodyEnvMult;
+        snappyEnvMult = choked ? chokeEnvMult : coeffs.snappyEnvMult;
+    }
+
+    const Coeffs& getCoefficients() const { return coeffs; }
 
     void setParameters(float pitchSemi, float decaySec, float tone, float drive)
     {
-        baseFreq = 180.0f * std::pow(2.0f, pitchSemi / 12.0f);
-        decayTime = juce::jlimit(0.02f, 2.5f, decaySec);
-        toneAmount = juce::jlimit(0.0f, 1.0f, tone);
-        driveAmount = juce::jlimit(0.0f, 1.0f, drive);
-        bodyEnvMult = std::exp(-1.0f / (decayTime * (float)sampleRate));
-        snappyEnvMult = std::exp(-1.0f / (0.03f * (float)sampleRate));
-        // bandpass coeff approx for tone: center 1k..3k
-        float center = juce::jmap(toneAmount, 1000.0f, 3000.0f);
-        float Q = 0.7f;
-        float w0 = 2.0f * juce::MathConstants<float>::pi * center / (float)sampleRate;
-        float alpha = std::sin(w0) / (2.0f * Q);
-        b0 = alpha; b1 = 0.0f; b2 = -alpha;
-        a0 = 1.0f + alpha; a1 = -2.0f * std::cos(w0); a2 = 1.0f - alpha;
+        Coeffs c;
+        c.setPitch(pitchSemi, sampleRate);
+        c.setDecay(decaySec, sampleRate);
+        c.setTone(tone, sampleRate);
+        c.setDrive(drive, sampleRate);
+        setCoefficients(c);
     }
 
     void noteOn(float velocity)
     {
         active = true;
+        choked = false;
+        bodyEnvMult = coeffs.bodyEnvMult;
+        snappyEnvMult = coeffs.snappyEnvMult;
         bodyEnv = juce::jlimit(0.0f, 1.0f, velocity);
         snappyEnv = bodyEnv;
         bodyPhase = 0.0f;
         noiseState = 0x1234567u;
     }
 
-    void noteOnWithDelay(float velocity, int delaySamples)
+    void render(juce::AudioBuffer<float>& buffer, int startSample, int numSamples, const VoiceRamps& ramps = {})
     {
-        startDelaySamples = juce::jmax(0, delaySamples);
-        noteOn(velocity);
+        if (!active) return;
+        VoiceRender::render(*this, buffer, startSample, numSamples, ramps, coeffs.driveAmount, driveGain);
     }
 
-    void render(juce::AudioBuffer<float>& buffer, int startSample, int numSamples)
+    bool isActive() const { return active; }
+    float getLevel() const { return active ? juce::jmax(bodyEnv, snappyEnv) : 0.0f; }
+
+    // Fast fade-out used when the voice is choked
+    void choke()
     {
-        if (!active) return;
-        auto* L = buffer.getWritePointer(0);
-        auto* R = buffer.getNumChannels() > 1 ? buffer.getWritePointer(1) : nullptr;
-        for (int i = 0; i < numSamples; ++i)
+        choked = true;
+        bodyEnvMult = snappyEnvMult = chokeEnvMult;
+    }
+
+    void reset()
+    {
+        active = false; choked = false;
+        coeffs = {}; setLockMask(0);
+        bodyEnv = 0.0f; snappyEnv = 0.0f;
+        bodyEnvMult = coeffs.bodyEnvMult; snappyEnvMult = coeffs.snappyEnvMult;
+        ic1eq = ic2eq = 0.0f;
+    }
+
+    // Writes up to maxSamples undriven samples to dest; returns how many before the voice ended
+    template <bool Ramped>
+    int renderMono(float* dest, int startSample, int maxSamples, const VoiceRamps& ramps)
+    {
+        const bool rampPitch = Ramped && followsRamp(VoiceRamps::Pitch);
+        const bool rampTone  = Ramped && followsRamp(VoiceRamps::Tone);
+        const bool rampDecay = Ramped && followsRamp(VoiceRamps::Decay);
+
+        int i = 0;
+        while (i < maxSamples)
         {
             int idx = startSample + i;
-            if (startDelaySamples > 0) { --startDelaySamples; continue; }
+            const float baseFreq = rampPitch ? ramps[VoiceRamps::Pitch][idx] : coeffs.baseFreq;
+            const float g        = rampTone  ? ramps[VoiceRamps::Tone][idx]  : coeffs.g;
+            const float a1       = rampTone  ? Coeffs::svfA1(g)             : coeffs.a1;
+            const float envMult  = rampDecay && !choked ? ramps[VoiceRamps::Decay][idx] : bodyEnvMult;
 
-            // Body: lightly inharmonic ring
-            float f1 = baseFreq;
-            float f2 = baseFreq * 1.5f;
-            bodyPhase += f1 / (float)sampleRate;
+            // Body: lightly inharmonic ring, second partial at 1.5x
+            bodyPhase += baseFreq / (float)sampleRate;
             if (bodyPhase >= 1.0f) bodyPhase -= 1.0f;
-            float s1 = std::sin(bodyPhase * juce::MathConstants<float>::twoPi);
-            float s2 = std::sin(bodyPhase * juce::MathConstants<float>::twoPi * (f2/f1));
+            float s1 = FastSine::sin2pi(bodyPhase);
+            float s2 = FastSine::sin2pi(bodyPhase * 1.5f);
             float body = (s1 + 0.6f * s2) * bodyEnv;
 
             // Snappy: filtered noise burst
             float n = (float)((noiseState = noiseState * 1664525u + 1013904223u) & 0x00ffffff) / (float)0x00ffffff;
             n = n * 2.0f - 1.0f;
             float x = n * snappyEnv;
-            float y = (b0/a0) * x + (b1/a0) * x1 + (b2/a0) * x2 - (a1/a0) * y1 - (a2/a0) * y2;
-            x2 = x1; x1 = x; y2 = y1; y1 = y;
+            const float v3 = x - ic2eq;
+            const float v1 = a1 * ic1eq + g * a1 * v3;
+            const float v2 = ic2eq + g * v1;
+            ic1eq = 2.0f * v1 - ic1eq;
+            ic2eq = 2.0f * v2 - ic2eq;
+            float y = Coeffs::k * v1; // unity gain at the centre frequency
 
             float out = body + 0.7f * y;
 
-            if (driveAmount > 0.001f)
-                out = juce::jmap(driveAmount, out, std::tanh(out * (1.0f + 3.0f * driveAmount)));
-
-            L[idx] += out;
-            if (R) R[idx] += out;
+            dest[i++] = out;
 
-            bodyEnv *= bodyEnvMult;
+            bodyEnv *= envMult;
             snappyEnv *= snappyEnvMult;
             if (bodyEnv < 1e-4f && snappyEnv < 1e-4f)
             {
@@ -80,35 +170,24 @@ public:
                 break;
             }
         }
-    }
-
-    void reset()
-    {
-        active = false; startDelaySamples = 0;
-        bodyEnv = 0.0f; snappyEnv = 0.0f;
-        bodyEnvMult = 0.995f; snappyEnvMult = 0.95f;
-        baseFreq = 180.0f; toneAmount = 0.5f; decayTime = 0.4f; driveAmount = 0.0f;
-        x1 = x2 = y1 = y2 = 0.0f;
+        return i;
     }
 
 private:
+    static constexpr float driveGain = 3.0f;
+
     double sampleRate { 44100.0 };
     bool active { false };
-
-    float baseFreq { 180.0f };
-    float decayTime { 0.4f };
-    float toneAmount { 0.5f };
-    float driveAmount { 0.0f };
+    bool choked { false };
+    Coeffs coeffs;
 
     float bodyEnv { 0.0f }, bodyEnvMult { 0.995f };
     float snappyEnv { 0.0f }, snappyEnvMult { 0.95f };
+    float chokeEnvMult { 0.995f };
 
     float bodyPhase { 0.0f };
     unsigned int noiseState { 1u };
 
-    // Biquad state
-    float b0{0}, b1{0}, b2{0}, a0{1}, a1{0}, a2{0};
-    float x1{0}, x2{0}, y1{0}, y2{0};
-
-    int startDelaySamples { 0 };
-};
\ No newline at end of file
+    // State variable filter integrator states
+    float ic1eq { 0.0f }, ic2eq { 0.0f };
+};
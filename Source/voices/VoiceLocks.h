@@ -0,0 +1,32 @@
+#pragma once
+#include <JuceHeader.h>
+#include "VoiceRamps.h"
+
+// Step locks on a sounding synth voice. The lock mask holds one bit per
+// VoiceRamps::Index for the parameters the voice's step locked; those keep the
+// values the voice started with, ignoring both the lane's later changes and its
+// ramps. Voice provides Coeffs (with copyFrom(lane, mask)), getCoefficients() and
+// setCoefficients().
+template <typename Voice>
+class LockableVoice
+{
+public:
+    void setLockMask(juce::uint32 mask) { lockMask = mask; }
+    juce::uint32 getLockMask() const { return lockMask; }
+
+    // Whether the lane's ramp for a parameter drives this voice while it sounds
+    bool followsRamp(VoiceRamps::Index i) const { return ! VoiceRamps::has(lockMask, i); }
+
+    // Takes the lane's changed parameters, except the locked ones
+    template <typename Coeffs>
+    void updateCoefficients(const Coeffs& lane, juce::uint32 changed)
+    {
+        auto& voice = static_cast<Voice&>(*this);
+        auto coeffs = voice.getCoefficients();
+        coeffs.copyFrom(lane, changed & ~lockMask);
+        voice.setCoefficients(coeffs);
+    }
+
+private:
+    juce::uint32 lockMask { 0 };
+};
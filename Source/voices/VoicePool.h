@@ -0,0 +1,143 @@
+#pragma once
+#include <JuceHeader.h>
+#include "../utils/BitOps.h"
+
+// Preallocated voices for one lane. A trigger takes a free voice, or steals one
+// once the polyphony limit is reached. A stolen voice is choked rather than cut:
+// it fades out in its slot while the new note starts in another, which the
+// FadeVoices slots beyond MaxVoices keep free even at full polyphony. Sounding
+// voices are tracked in a bit mask so render() never visits idle voices.
+// Voice needs prepare(), reset(), render(), isActive(), getLevel() and choke().
+template <typename Voice, int MaxVoices = 8, int FadeVoices = 2>
+class VoicePool
+{
+    static constexpr int numSlots = MaxVoices + FadeVoices;
+    static_assert(MaxVoices > 0 && FadeVoices >= 0 && numSlots <= 32, "active voices are tracked in a 32-bit mask");
+
+public:
+    enum StealMode { Oldest, Quietest };
+
+    VoicePool() = default;
+    explicit VoicePool(const Voice& prototype) { voices.fill(prototype); }
+
+    void prepare(double sr)
+    {
+        for (auto& v : voices)
+            v.prepare(sr);
+        activeMask = fadingMask = 0;
+        noteCounter = 0;
+    }
+
+    void reset()
+    {
+        for (auto& v : voices)
+            v.reset();
+        activeMask = fadingMask = 0;
+    }
+
+    // Lowering the polyphony lets voices above the new limit ring out
+    void setPolyphony(int numVoices) { polyphony = juce::jlimit(1, MaxVoices, numVoices); }
+    int getPolyphony() const { return polyphony; }
+    void setStealMode(StealMode mode) { stealMode = mode; }
+
+    // Claims a voice for a new note; the caller sets its parameters and starts it.
+    // Voices fading out after a steal no longer count towards the polyphony.
+    Voice& startVoice()
+    {
+        if (juce::countNumberOfBits(activeMask & ~fadingMask) >= polyphony)
+        {
+            const int stolen = findVoiceToSteal();
+            voices[(size_t) stolen].choke();
+            fadingMask |= bit(stolen);
+        }
+
+        const int index = findFreeVoice();
+        activeMask |= bit(index);
+        fadingMask &= ~bit(index);
+        startOrder[(size_t) index] = ++noteCounter;
+        return voices[(size_t) index];
+    }
+
+    template <typename Fn>
+    void forEachActive(Fn&& fn)
+    {
+        for (auto mask = activeMask; mask != 0; mask &= mask - 1)
+            fn(voices[(size_t) BitOps::countTrailingZeros(mask)]);
+    }
+
+    void choke()
+    {
+        forEachActive([](Voice& v) { v.choke(); });
+    }
+
+    // Extra arguments, such as the lane's parameter ramps, are passed on to every voice
+    template <typename... Args>
+    void render(juce::AudioBuffer<float>& buffer, int startSample, int numSamples, Args&&... args)
+    {
+        for (auto mask = activeMask; mask != 0; mask &= mask - 1)
+        {
+            const int index = BitOps::countTrailingZeros(mask);
+            auto& v = voices[(size_t) index];
+            v.render(buffer, startSample, numSamples, args...);
+            if (!v.isActive())
+            {
+                activeMask &= ~bit(index);
+                fadingMask &= ~bit(index);
+            }
+        }
+    }
+
+    bool isActive() const { return activeMask != 0; }
+    int getNumActiveVoices() const { return juce::countNumberOfBits(activeMask); }
+
+private:
+    static juce::uint32 bit(int index) { return (juce::uint32) 1 << index; }
+
+    // A slot that is not sounding. Should every slot be busy, as after several steals
+    // within a fade, the fading voice that started first is cut short instead.
+    int findFreeVoice() const
+    {
+        const auto freeMask = ~activeMask & (juce::uint32) (((juce::uint64) 1 << numSlots) - 1);
+        if (freeMask != 0)
+            return BitOps::countTrailingZeros(freeMask);
+        return findFirstStarted(fadingMask);
+    }
+
+    // Candidates are the sounding voices not already fading out; there is always one,
+    // as stealing only happens with polyphony (at least 1) of them sounding
+    int findVoiceToSteal() const
+    {
+        const auto candidates = activeMask & ~fadingMask;
+        if (stealMode == Oldest)
+            return findFirstStarted(candidates);
+
+        int best = -1;
+        for (auto mask = candidates; mask != 0; mask &= mask - 1)
+        {
+            const int index = BitOps::countTrailingZeros(mask);
+            if (best < 0 || voices[(size_t) index].getLevel() < voices[(size_t) best].getLevel())
+                best = index;
+        }
+        return best;
+    }
+
+    int findFirstStarted(juce::uint32 candidates) const
+    {
+        int best = -1;
+        for (auto mask = candidates; mask != 0; mask &= mask - 1)
+        {
+            const int index = BitOps::countTrailingZeros(mask);
+            if (best < 0 || startOrder[(size_t) index] < startOrder[(size_t) best])
+                best = index;
+        }
+        return best;
+    }
+
+    std::array<Voice, (size_t) numSlots> voices;
+    std::array<juce::uint32, (size_t) numSlots> startOrder {};
+    juce::uint32 activeMask { 0 };
+    juce::uint32 fadingMask { 0 };   // active voices choked by a steal
+    juce::uint32 noteCounter { 0 };
+    int polyphony { MaxVoices };
+    StealMode stealMode { Oldest };
+};
@@ -0,0 +1,18 @@
+#pragma once
+#include <JuceHeader.h>
+
+// Per-sample coefficient ramps shared by the voices of one lane, one value per sample
+// of the current block. What each ramp holds is defined by the voice's Coeffs.
+// All pointers are null while none of the lane's parameters is moving.
+struct VoiceRamps
+{
+    enum Index { Pitch, Decay, Tone, Drive, NumRamps };
+
+    std::array<const float*, NumRamps> data {};
+
+    bool isActive() const { return data[0] != nullptr; }
+
+    // Bit i of a parameter mask, such as a voice's step locks
+    static bool has(juce::uint32 mask, Index i) { return (mask & (1u << i)) != 0; }
+    const float* operator[](Index i) const { return data[(size_t) i]; }
+};
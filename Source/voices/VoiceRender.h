@@ -0,0 +1,69 @@
+#pragma once
+#include <JuceHeader.h>
+#include "VoiceRamps.h"
+#include "../dsp/DriveStage.h"
+
+// Shared render path for the mono synth voices. The voice writes undriven samples into a
+// small stack buffer through renderMono<Ramped>(dest, startSample, maxSamples, ramps), which
+// returns how many it produced before finishing; it reads the ramps only for parameters
+// its step did not lock. Each chunk then goes through the drive stage, skipped while the
+// drive is off, and is added to the first two channels.
+namespace VoiceRender
+{
+    static constexpr int chunkSize = 64;
+
+    template <bool Ramped, bool Driven, typename Voice>
+    void renderChunks(Voice& voice, juce::AudioBuffer<float>& buffer, int startSample, int numSamples,
+                      const VoiceRamps& ramps, float drive, float driveGain)
+    {
+        auto* left  = buffer.getWritePointer(0);
+        auto* right = buffer.getNumChannels() > 1 ? buffer.getWritePointer(1) : nullptr;
+        float mono[chunkSize];
+
+        for (int done = 0; done < numSamples && voice.isActive();)
+        {
+            const int offset = startSample + done;
+            const int n = voice.template renderMono<Ramped>(mono, offset, juce::jmin(chunkSize, numSamples - done), ramps);
+            if (n <= 0)
+                break;
+
+            if constexpr (Ramped)
+            {
+                // A linear ramp is above the threshold somewhere only if one of its ends is.
+                // A voice whose step locked the drive keeps its own amount.
+                const float* d = ramps[VoiceRamps::Drive] + offset;
+                if (! voice.followsRamp(VoiceRamps::Drive))
+                {
+                    if (DriveStage::isEngaged(drive))
+                        DriveStage::process(mono, n, drive, driveGain);
+                }
+                else if (DriveStage::isEngaged(d[0]) || DriveStage::isEngaged(d[n - 1]))
+                {
+                    DriveStage::process(mono, n, d, driveGain);
+                }
+            }
+            else if constexpr (Driven)
+            {
+                DriveStage::process(mono, n, drive, driveGain);
+            }
+
+            juce::FloatVectorOperations::add(left + offset, mono, n);
+            if (right != nullptr)
+                juce::FloatVectorOperations::add(right + offset, mono, n);
+            done += n;
+        }
+    }
+
+    // Picks the instantiation once per call; with the drive off the stage compiles out
+    template <typename Voice>
+    void render(Voice& voice, juce::AudioBuffer<float>& buffer, int startSample, int numSamples,
+                const VoiceRamps& ramps, float drive, float driveGain)
+    {
+        if (ramps.isActive())
+            renderChunks<true, true>(voice, buffer, startSample, numSamples, ramps, drive, driveGain);
+        else if (DriveStage::isEngaged(drive))
+            renderChunks<false, true>(voice, buffer, startSample, numSamples, ramps, drive, driveGain);
+        else
+            renderChunks<false, false>(voice, buffer, startSample, numSamples, ramps, drive, driveGain);
+    }
+}
@@ -0,0 +1,250 @@
+/*
+  ==============================================================================
+
+    Headless offline renderer: loads a saved DrumMachine state and bounces
+    N bars of the internal sequencer to a WAV file as fast as the CPU allows.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "../../../Source/PluginProcessor.h"
+#include "../../../Source/utils/AllocationHooks.h"   // debug builds flag heap use in processBlock
+
+namespace
+{
+    const char* const laneNames[] = { "bd", "sd", "ch", "oh", "clap" };
+    constexpr int numLanes = 5;
+
+    struct RenderSettings
+    {
+        juce::File stateFile;
+        juce::File outFile;
+        int bars { 4 };
+        double sampleRate { 48000.0 };
+        int blockSize { 512 };
+        int bitDepth { 24 };
+        double tempo { 0.0 }; // 0 keeps the tempo stored in the state
+        juce::StringArray samples; // "lane=path"
+        bool stems { false };
+        SampleData::Storage storage { SampleData::InMemory };
+        juce::String songChain; // non-empty plays the bank in song mode
+    };
+
+    int laneIndexFromName(const juce::String& name)
+    {
+        for (int i = 0; i < numLanes; ++i)
+            if (name.equalsIgnoreCase(laneNames[i]))
+                return i;
+        return -1;
+    }
+
+    void printUsage()
+    {
+        std::cout << "Usage: OfflineRender --state <file> --out <file.wav> [options]\n"
+                  << "  --bars <n>            number of 4/4 bars to render (default 4)\n"
+                  << "  --rate <hz>           sample rate (default 48000)\n"
+                  << "  --block <n>           processBlock size (default 512)\n"
+                  << "  --bits <16|24|32>     WAV bit depth (default 24)\n"
+                  << "  --tempo <bpm>         override the tempo stored in the state\n"
+                  << "  --sample <lane>=<f>   load a sample or kit folder into a lane (bd, sd, ch, oh, clap)\n"
+                  << "  --mapped              play WAV/AIFF samples from a memory mapping instead of RAM\n"
+                  << "  --stream              stream samples from disk, keeping only their first frames in RAM\n"
+                  << "  --song <chain>        play bank patterns in song mode, e.g. \"1x4 2 3x2\"\n"
+                  << "  --stems               also write one file per lane next to --out\n";
+    }
+
+    void setParameter(DrumMachineAudioProcessor& processor, const char* id, float value)
+    {
+        if (auto* param = processor.getAPVTS().getParameter(id))
+            param->setValueNotifyingHost(param->convertTo0to1(value));
+    }
+
+    std::unique_ptr<DrumMachineAudioProcessor> createProcessor(const RenderSettings& settings, int soloLane)
+    {
+        auto processor = std::make_unique<DrumMachineAudioProcessor>();
+
+        if (settings.stateFile.existsAsFile())
+        {
+            juce::MemoryBlock state;
+            if (! settings.stateFile.loadFileAsData(state))
+                return nullptr;
+            processor->setStateInformation(state.getData(), (int) state.getSize());
+        }
+
+        for (const auto& entry : settings.samples)
+        {
+            const int lane = laneIndexFromName(entry.upToFirstOccurrenceOf("=", false, false));
+            const auto file = juce::File::getCurrentWorkingDirectory()
+                                  .getChildFile(entry.fromFirstOccurrenceOf("=", false, false));
+            if (lane >= 0)
+                processor->setSampleStorageForLane(lane, settings.storage);
+            if (lane < 0 || ! processor->loadSampleForLane(lane, file))
+            {
+                std::cerr << "Could not load sample: " << entry << "\n";
+                return nullptr;
+            }
+        }
+
+        // Offline rendering always runs the internal sequencer transport
+        setParameter(*processor, DMParams::seqEnableId, 1.0f);
+        if (settings.tempo > 0.0)
+            setParameter(*processor, DMParams::tempoId, (float) settings.tempo);
+        if (settings.songChain.isNotEmpty())
+        {
+            processor->setSongChain(SongTimeline::parseChain(settings.songChain));
+            setParameter(*processor, DMParams::songModeId, 1.0f);
+        }
+
+        // Song mode plays every bank slot, so the other lanes are emptied in all of them,
+        // keeping their lengths and divisions so the song's entries stay as long
+        if (soloLane >= 0)
+        {
+            for (int lane = 0; lane < numLanes; ++lane)
+            {
+                if (lane == soloLane) continue;
+                auto* seq = processor->getSequencerForLane(lane);
+                seq->applyEdits([seq]
+                {
+                    for (int p = 0; p < StepSequencer::numPatterns; ++p)
+                    {
+                        StepSequencer::Pattern empty;
+                        empty.steps = seq->getPattern(p).steps;
+                        empty.division = seq->getPattern(p).division;
+                        seq->setPattern(p, empty);
+                    }
+                });
+            }
+        }
+
+        return processor;
+    }
+
+    bool renderToFile(DrumMachineAudioProcessor& processor, const RenderSettings& settings, const juce::File& outFile)
+    {
+        const double sampleRate = settings.sampleRate;
+        const int blockSize = settings.blockSize;
+
+        processor.setNonRealtime(true);
+        processor.setPlayHead(nullptr);
+        processor.setPlayConfigDetails(processor.getTotalNumInputChannels(),
+                                       processor.getTotalNumOutputChannels(),
+                                       sampleRate, blockSize);
+        processor.prepareToPlay(sampleRate, blockSize);
+
+        const double tempo = (double) processor.getAPVTS().getRawParameterValue(DMParams::tempoId)->load();
+        const auto totalSamples = (juce::int64) std::ceil(settings.bars * 4.0 * 60.0 / tempo * sampleRate);
+
+        const int numOutputs = juce::jmax(1, processor.getTotalNumOutputChannels());
+        const int numChannels = juce::jmax(processor.getTotalNumInputChannels(), numOutputs);
+
+        outFile.deleteFile();
+        std::unique_ptr<juce::OutputStream> stream (outFile.createOutputStream());
+        if (stream == nullptr)
+        {
+            std::cerr << "Could not open " << outFile.getFullPathName() << " for writing\n";
+            return false;
+        }
+
+        juce::WavAudioFormat wav;
+        std::unique_ptr<juce::AudioFormatWriter> writer (wav.createWriterFor(stream.get(), sampleRate,
+                                                                              (unsigned int) numOutputs,
+                                                                              settings.bitDepth, {}, 0));
+        if (writer == nullptr)
+        {
+            std::cerr << "Unsupported WAV format: " << settings.bitDepth << " bit\n";
+            return false;
+        }
+        stream.release(); // now owned by the writer
+
+        juce::AudioBuffer<float> block (numChannels, blockSize);
+        juce::MidiBuffer midi;
+        juce::int64 engineTicks = 0;
+        const auto startTicks = juce::Time::getHighResolutionTicks();
+
+        for (juce::int64 done = 0; done < totalSamples;)
+        {
+            const int n = (int) juce::jmin((juce::int64) blockSize, totalSamples - done);
+            juce::AudioBuffer<float> view (block.getArrayOfWritePointers(), numChannels, n);
+            view.clear();
+            midi.clear();
+
+            const auto blockStart = juce::Time::getHighResolutionTicks();
+            processor.processBlock(view, midi);
+            engineTicks += juce::Time::getHighResolutionTicks() - blockStart;
+
+            writer->writeFromAudioSampleBuffer(view, 0, n);
+            done += n;
+        }
+
+        writer.reset();
+        processor.releaseResources();
+
+        const double audioSeconds = (double) totalSamples / sampleRate;
+        const double totalSeconds = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - startTicks);
+        const double engineSeconds = juce::Time::highResolutionTicksToSeconds(engineTicks);
+
+        std::cout << outFile.getFileName() << ": " << juce::String(audioSeconds, 2) << " s of audio in "
+                  << juce::String(totalSeconds, 3) << " s (engine " << juce::String(engineSeconds, 3) << " s), "
+                  << "realtime factor " << juce::String(audioSeconds / juce::jmax(1.0e-9, totalSeconds), 1) << "x"
+                  << " (engine " << juce::String(audioSeconds / juce::jmax(1.0e-9, engineSeconds), 1) << "x)\n";
+        if (const auto underruns = processor.getSampleStreamUnderruns())
+            std::cerr << "Sample streams ran dry " << (int) underruns << " times\n";
+        return true;
+    }
+}
+
+int main (int argc, char* argv[])
+{
+    juce::ScopedJuceInitialiser_GUI juceInit;
+    juce::ArgumentList args (argc, argv);
+
+    if (args.containsOption("--help|-h") || ! args.containsOption("--out"))
+    {
+        printUsage();
+        return args.containsOption("--help|-h") ? 0 : 1;
+    }
+
+    const auto cwd = juce::File::getCurrentWorkingDirectory();
+    RenderSettings settings;
+    settings.outFile = cwd.getChildFile(args.getValueForOption("--out"));
+    if (args.containsOption("--state"))
+        settings.stateFile = cwd.getChildFile(args.getValueForOption("--state"));
+    if (args.containsOption("--bars"))  settings.bars = juce::jmax(1, args.getValueForOption("--bars").getIntValue());
+    if (args.containsOption("--rate"))  settings.sampleRate = juce::jlimit(8000.0, 384000.0, args.getValueForOption("--rate").getDoubleValue());
+    if (args.containsOption("--block")) settings.blockSize = juce::jlimit(1, 65536, args.getValueForOption("--block").getIntValue());
+    if (args.containsOption("--bits"))  settings.bitDepth = args.getValueForOption("--bits").getIntValue();
+    if (args.containsOption("--tempo")) settings.tempo = args.getValueForOption("--tempo").getDoubleValue();
+    if (args.containsOption("--song"))  settings.songChain = args.getValueForOption("--song");
+    settings.stems = args.containsOption("--stems");
+    if (args.containsOption("--mapped")) settings.storage = SampleData::MemoryMapped;
+    if (args.containsOption("--stream")) settings.storage = SampleData::Streamed;
+
+    for (int i = 0; i + 1 < args.size(); ++i)
+        if (args[i] == "--sample")
+            settings.samples.add(args[i + 1].text);
+
+    if (settings.stateFile != juce::File() && ! settings.stateFile.existsAsFile())
+    {
+        std::cerr << "State file not found: " << settings.stateFile.getFullPathName() << "\n";
+        return 1;
+    }
+
+    auto mix = createProcessor(settings, -1);
+    if (mix == nullptr || ! renderToFile(*mix, settings, settings.outFile))
+        return 1;
+
+    if (settings.stems)
+    {
+        for (int lane = 0; lane < numLanes; ++lane)
+        {
+            auto stem = createProcessor(settings, lane);
+            const auto stemFile = settings.outFile.getSiblingFile(settings.outFile.getFileNameWithoutExtension()
+                                                                  + "_" + laneNames[lane] + ".wav");
+            if (stem == nullptr || ! renderToFile(*stem, settings, stemFile))
+                return 1;
+        }
+    }
+
+    return 0;
+}
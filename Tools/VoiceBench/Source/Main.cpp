@@ -0,0 +1,409 @@
+/*
+  ==============================================================================
+
+    Voice micro-benchmarks: measures ns/sample and realtime factor of every
+    voice render loop across block sizes, sample rates, drive and voice state,
+    plus the shared DSP kernels against the libm paths they replace, and the
+    cost of starting hits with per-step parameter locks.
+    Results are written as CSV or JSON so builds can be compared.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "../../../Source/voices/BDVoice.h"
+#include "../../../Source/voices/SDVoice.h"
+#include "../../../Source/voices/HHVoice.h"
+#include "../../../Source/voices/ClapVoice.h"
+#include "../../../Source/sampling/SampleLayer.h"
+#include "../../../Source/dsp/FastSine.h"
+#include "../../../Source/sequencer/StepLocks.h"
+
+namespace
+{
+    struct BenchConfig
+    {
+        std::vector<double> sampleRates { 44100.0, 48000.0, 96000.0, 192000.0 };
+        std::vector<int> blockSizes { 16, 32, 64, 128, 256, 512, 1024, 2048, 4096 };
+        double secondsPerCase { 1.0 };
+        juce::String filter;
+    };
+
+    struct Result
+    {
+        juce::String suite, name;
+        double sampleRate { 0.0 };
+        int blockSize { 0 };
+        bool drive { false };
+        bool active { false };
+        double nsPerSample { 0.0 };
+        double realtimeFactor { 0.0 };
+    };
+
+    // Adapters give every voice the same small interface for the benchmark loop.
+    template <typename Voice>
+    struct SynthAdapter
+    {
+        SynthAdapter(Voice v, float decay) : voice(v), decaySeconds(decay) {}
+
+        static constexpr bool hasDrive = true;
+        void prepare(double sr) { voice.prepare(sr); }
+        void setDrive(bool on) { voice.setParameters(0.0f, decaySeconds, 0.5f, on ? 0.8f : 0.0f); }
+        void trigger() { voice.noteOn(1.0f); }
+        bool isActive() const { return voice.isActive(); }
+        void render(juce::AudioBuffer<float>& b, int n) { voice.render(b, 0, n); }
+
+        Voice voice;
+        float decaySeconds;
+    };
+
+    // Retriggers a voice on every 1/32 note at 120 BPM the way the processor starts a
+    // step: the lane coefficients as they are, or with every parameter locked. The locks
+    // hold the lane's own values, so both play the same sound and the two rows differ
+    // only by the cost of applying the locks.
+    template <typename Voice>
+    struct LockAdapter
+    {
+        static constexpr float lanePitch = 0.0f, laneDecay = 0.5f, laneTone = 0.5f, laneDrive = 0.0f;
+
+        LockAdapter(Voice v, bool lockAll) : voice(v)
+        {
+            if (lockAll)
+            {
+                locks.set(StepLocks::Pitch, lanePitch);
+                locks.set(StepLocks::Decay, laneDecay);
+                locks.set(StepLocks::Tone, laneTone);
+                locks.set(StepLocks::Drive, laneDrive);
+            }
+        }
+
+        static constexpr bool hasDrive = false;
+
+        void prepare(double sr)
+        {
+            sampleRate = sr;
+            voice.prepare(sr);
+            laneCoeffs = {};
+            laneCoeffs.setPitch(lanePitch, sr);
+            laneCoeffs.setDecay(laneDecay, sr);
+            laneCoeffs.setTone(laneTone, sr);
+            laneCoeffs.setDrive(laneDrive, sr);
+            stepLength = juce::jmax(1, (int) (sr / 16.0));
+            untilStep = 0;
+            running = false;
+        }
+
+        void setDrive(bool) {}
+        void trigger() { running = true; }
+        bool isActive() const { return running; }
+
+        void render(juce::AudioBuffer<float>& b, int n)
+        {
+            for (int done = 0; done < n;)
+            {
+                if (running && untilStep == 0)
+                {
+                    startStep();
+                    untilStep = stepLength;
+                }
+                const int len = running ? juce::jmin(n - done, untilStep) : n - done;
+                voice.render(b, done, len);
+                done += len;
+                if (running)
+                    untilStep -= len;
+            }
+        }
+
+        void startStep()
+        {
+            voice.setLockMask(locks.mask);
+            if (locks.mask == 0)
+            {
+                voice.setCoefficients(laneCoeffs);
+            }
+            else
+            {
+                auto coeffs = laneCoeffs;
+                locks.apply(coeffs, sampleRate);
+                voice.setCoefficients(coeffs);
+            }
+            voice.noteOn(1.0f);
+        }
+
+        Voice voice;
+        typename Voice::Coeffs laneCoeffs;
+        StepLocks locks;
+        double sampleRate { 44100.0 };
+        int stepLength { 1 }, untilStep { 0 };
+        bool running { false };
+    };
+
+    // tune 0 plays the converted sample frame for frame; other tunes run the interpolation kernel
+    struct SampleAdapter
+    {
+        SampleAdapter(Interpolation::Quality q = Interpolation::Linear, float semitones = 0.0f) : quality(q), tune(semitones) {}
+
+        static constexpr bool hasDrive = false;
+        void prepare(double sr) { layer.prepare(sr); layer.convertToSessionRate(); layer.setInterpolation(quality); }
+        void setDrive(bool) { layer.setParameters(tune, 0, 1.0f); }
+        void trigger() { layer.noteOn(1.0f); }
+        bool isActive() const { return layer.isActive(); }
+        void render(juce::AudioBuffer<float>& b, int n) { layer.beginBlock(n); layer.render(b, 0, n); }
+
+        SampleLayer layer;
+        Interpolation::Quality quality;
+        float tune;
+    };
+
+    // A 440 Hz oscillator written into the buffer by one of the sine implementations
+    struct SineAdapter
+    {
+        enum Mode { StdSin, FastScalar, FastBlock };
+        explicit SineAdapter(Mode m) : mode(m) {}
+
+        static constexpr bool hasDrive = false;
+        void prepare(double sr) { increment = (float) (440.0 / sr); phase = 0.0f; }
+        void setDrive(bool) {}
+        void trigger() {}
+        bool isActive() const { return true; }
+
+        void render(juce::AudioBuffer<float>& b, int n)
+        {
+            auto* out = b.getWritePointer(0);
+            switch (mode)
+            {
+                case StdSin:
+                    for (int i = 0; i < n; ++i)
+                    {
+                        out[i] = std::sin(phase * juce::MathConstants<float>::twoPi);
+                        phase += increment;
+                        if (phase >= 1.0f) phase -= 1.0f;
+                    }
+                    break;
+                case FastScalar:
+                    for (int i = 0; i < n; ++i)
+                    {
+                        out[i] = FastSine::sin2pi(phase);
+                        phase += increment;
+                        if (phase >= 1.0f) phase -= 1.0f;
+                    }
+                    break;
+                case FastBlock:
+                    phase = FastSine::process(out, n, phase, increment);
+                    break;
+            }
+        }
+
+        Mode mode;
+        float phase { 0.0f }, increment { 0.0f };
+    };
+
+    template <typename Adapter>
+    Result measure(Adapter& adapter, const BenchConfig& config, double sampleRate, int blockSize, bool drive, bool active)
+    {
+        adapter.prepare(sampleRate);
+        adapter.setDrive(drive);
+
+        juce::AudioBuffer<float> buffer (2, blockSize);
+
+        // Voices add into the buffer, so it starts every block empty as in a host;
+        // left to accumulate it would drift towards denormals and skew the timings
+        const int numBlocks = juce::jmax(8, (int) std::ceil(config.secondsPerCase * sampleRate / blockSize));
+        auto runBlocks = [&](int count)
+        {
+            for (int b = 0; b < count; ++b)
+            {
+                buffer.clear();
+                if (active && ! adapter.isActive())
+                    adapter.trigger();
+                adapter.render(buffer, blockSize);
+            }
+        };
+
+        runBlocks(juce::jmax(1, numBlocks / 10)); // warm caches and branch predictors
+
+        const auto start = juce::Time::getHighResolutionTicks();
+        runBlocks(numBlocks);
+        const double elapsed = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - start);
+
+        // keep the optimiser from discarding the output
+        static volatile float sink = 0.0f;
+        sink = sink + buffer.getSample(0, blockSize - 1);
+
+        const double totalSamples = (double) numBlocks * blockSize;
+        Result r;
+        r.sampleRate = sampleRate;
+        r.blockSize = blockSize;
+        r.drive = drive;
+        r.active = active;
+        r.nsPerSample = elapsed * 1.0e9 / totalSamples;
+        r.realtimeFactor = (totalSamples / sampleRate) / juce::jmax(1.0e-12, elapsed);
+        return r;
+    }
+
+    template <typename Adapter>
+    void runVoiceSuite(const char* name, Adapter&& adapter, const BenchConfig& config, std::vector<Result>& results,
+                       const char* suite = "voice")
+    {
+        if (config.filter.isNotEmpty() && ! config.filter.equalsIgnoreCase(name) && ! config.filter.equalsIgnoreCase(suite))
+            return;
+
+        for (auto sr : config.sampleRates)
+            for (auto bs : config.blockSizes)
+                for (int drive = 0; drive < (std::decay_t<Adapter>::hasDrive ? 2 : 1); ++drive)
+                    for (int active = 0; active < 2; ++active)
+                    {
+                        auto r = measure(adapter, config, sr, bs, drive == 1, active == 1);
+                        r.suite = suite;
+                        r.name = name;
+                        results.push_back(r);
+                        std::cerr << ".";
+                    }
+    }
+
+    bool prepareSampleLayer(SampleLayer& layer, const juce::File& tempWav, SampleData::Storage storage)
+    {
+        // Two seconds of stereo noise stands in for a one-shot
+        const double rate = 44100.0;
+        juce::AudioBuffer<float> noise (2, (int) (2.0 * rate));
+        juce::Random rng (42);
+        for (int ch = 0; ch < noise.getNumChannels(); ++ch)
+            for (int i = 0; i < noise.getNumSamples(); ++i)
+                noise.setSample(ch, i, rng.nextFloat() * 2.0f - 1.0f);
+
+        tempWav.deleteFile();
+        std::unique_ptr<juce::OutputStream> stream (tempWav.createOutputStream());
+        juce::WavAudioFormat wav;
+        std::unique_ptr<juce::AudioFormatWriter> writer (stream != nullptr ? wav.createWriterFor(stream.get(), rate, 2, 24, {}, 0)
+                                                                           : nullptr);
+        if (writer == nullptr)
+            return false;
+        stream.release();
+        writer->writeFromAudioSampleBuffer(noise, 0, noise.getNumSamples());
+        writer.reset();
+        layer.setStorage(storage);
+        return layer.loadFromFile(tempWav);
+    }
+
+    juce::String toCsv(const std::vector<Result>& results)
+    {
+        juce::String out ("suite,name,sample_rate,block_size,drive,state,ns_per_sample,realtime_factor\n");
+        for (const auto& r : results)
+            out << r.suite << "," << r.name << "," << juce::String(r.sampleRate, 0) << "," << r.blockSize << ","
+                << (r.drive ? "on" : "off") << "," << (r.active ? "active" : "idle") << ","
+                << juce::String(r.nsPerSample, 3) << "," << juce::String(r.realtimeFactor, 1) << "\n";
+        return out;
+    }
+
+    juce::String toJson(const std::vector<Result>& results)
+    {
+        juce::String out ("[\n");
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            const auto& r = results[i];
+            out << "  { \"suite\": \"" << r.suite << "\", \"name\": \"" << r.name << "\""
+                << ", \"sample_rate\": " << juce::String(r.sampleRate, 0)
+                << ", \"block_size\": " << r.blockSize
+                << ", \"drive\": " << (r.drive ? "true" : "false")
+                << ", \"state\": \"" << (r.active ? "active" : "idle") << "\""
+                << ", \"ns_per_sample\": " << juce::String(r.nsPerSample, 3)
+                << ", \"realtime_factor\": " << juce::String(r.realtimeFactor, 1)
+                << (i + 1 < results.size() ? " },\n" : " }\n");
+        }
+        out << "]\n";
+        return out;
+    }
+
+    void printUsage()
+    {
+        std::cout << "Usage: VoiceBench [options]\n"
+                  << "  --format <csv|json>   output format (default csv)\n"
+                  << "  --out <file>          write results to a file instead of stdout\n"
+                  << "  --seconds <s>         audio seconds rendered per case (default 1.0)\n"
+                  << "  --voice <name>        only run one voice or suite (bd, sd, ch, oh, clap, sample, sample_mapped, interp, sine, plocks)\n"
+                  << "  --quick               48 kHz only, block sizes 64 and 512\n";
+    }
+}
+
+int main (int argc, char* argv[])
+{
+    juce::ArgumentList args (argc, argv);
+    if (args.containsOption("--help|-h"))
+    {
+        printUsage();
+        return 0;
+    }
+
+    BenchConfig config;
+    if (args.containsOption("--seconds"))
+        config.secondsPerCase = juce::jmax(0.01, args.getValueForOption("--seconds").getDoubleValue());
+    if (args.containsOption("--voice"))
+        config.filter = args.getValueForOption("--voice");
+    if (args.containsOption("--quick"))
+    {
+        config.sampleRates = { 48000.0 };
+        config.blockSizes = { 64, 512 };
+    }
+
+    juce::ScopedNoDenormals noDenormals;
+    std::vector<Result> results;
+
+    runVoiceSuite("bd",   SynthAdapter<BDVoice>   (BDVoice(), 4.0f), config, results);
+    runVoiceSuite("sd",   SynthAdapter<SDVoice>   (SDVoice(), 2.5f), config, results);
+    runVoiceSuite("ch",   SynthAdapter<HHVoice>   (HHVoice(HHVoice::Closed), 0.3f), config, results);
+    runVoiceSuite("oh",   SynthAdapter<HHVoice>   (HHVoice(HHVoice::Open), 2.0f), config, results);
+    runVoiceSuite("clap", SynthAdapter<ClapVoice> (ClapVoice(), 1.5f), config, results);
+
+    const auto tempWav = juce::File::getSpecialLocation(juce::File::tempDirectory).getChildFile("VoiceBench_noise.wav");
+    SampleAdapter sample, mappedSample;
+    SampleAdapter linear (Interpolation::Linear, 5.0f), cubic (Interpolation::Cubic, 5.0f), sinc (Interpolation::Sinc, 5.0f);
+    SampleAdapter octaveUp (Interpolation::Sinc, 12.0f); // plays the first mip level
+    if (prepareSampleLayer(sample.layer, tempWav, SampleData::InMemory)
+        && prepareSampleLayer(mappedSample.layer, tempWav, SampleData::MemoryMapped)
+        && prepareSampleLayer(linear.layer, tempWav, SampleData::InMemory)
+        && prepareSampleLayer(cubic.layer, tempWav, SampleData::InMemory)
+        && prepareSampleLayer(sinc.layer, tempWav, SampleData::InMemory)
+        && prepareSampleLayer(octaveUp.layer, tempWav, SampleData::InMemory))
+    {
+        runVoiceSuite("sample", sample, config, results);
+        runVoiceSuite("sample_mapped", mappedSample, config, results);
+        runVoiceSuite("sample_linear", linear, config, results, "interp");
+        runVoiceSuite("sample_cubic", cubic, config, results, "interp");
+        runVoiceSuite("sample_sinc", sinc, config, results, "interp");
+        runVoiceSuite("sample_sinc_up12", octaveUp, config, results, "interp");
+    }
+    else
+        std::cerr << "\nCould not create the test sample, skipping SampleLayer\n";
+    tempWav.deleteFile();
+
+    runVoiceSuite("std_sin",         SineAdapter(SineAdapter::StdSin),     config, results, "sine");
+    runVoiceSuite("fast_sin",        SineAdapter(SineAdapter::FastScalar), config, results, "sine");
+    runVoiceSuite("fast_sin_block",  SineAdapter(SineAdapter::FastBlock),  config, results, "sine");
+
+    runVoiceSuite("bd_unlocked",   LockAdapter<BDVoice>   (BDVoice(), false),   config, results, "plocks");
+    runVoiceSuite("bd_locked",     LockAdapter<BDVoice>   (BDVoice(), true),    config, results, "plocks");
+    runVoiceSuite("sd_unlocked",   LockAdapter<SDVoice>   (SDVoice(), false),   config, results, "plocks");
+    runVoiceSuite("sd_locked",     LockAdapter<SDVoice>   (SDVoice(), true),    config, results, "plocks");
+    runVoiceSuite("clap_unlocked", LockAdapter<ClapVoice> (ClapVoice(), false), config, results, "plocks");
+    runVoiceSuite("clap_locked",   LockAdapter<ClapVoice> (ClapVoice(), true),  config, results, "plocks");
+    std::cerr << "\n";
+
+    const auto format = args.containsOption("--format") ? args.getValueForOption("--format") : juce::String("csv");
+    const auto text = format.equalsIgnoreCase("json") ? toJson(results) : toCsv(results);
+
+    if (args.containsOption("--out"))
+    {
+        const auto outFile = juce::File::getCurrentWorkingDirectory().getChildFile(args.getValueForOption("--out"));
+        if (! outFile.replaceWithText(text))
+        {
+            std::cerr << "Could not write " << outFile.getFullPathName() << "\n";
+            return 1;
+        }
+    }
+    else
+    {
+        std::cout << text;
+    }
+
+    return 0;
+}